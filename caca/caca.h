@@ -402,6 +402,10 @@ __extern int caca_set_dither_color(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_color_list(caca_dither_t
                                                           const *);
 __extern char const * caca_get_dither_color(caca_dither_t const *);
+__extern int caca_set_dither_metric(caca_dither_t *, char const *);
+__extern char const * const * caca_get_dither_metric_list(caca_dither_t
+                                                           const *);
+__extern char const * caca_get_dither_metric(caca_dither_t const *);
 __extern int caca_set_dither_charset(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_charset_list(caca_dither_t
                                                             const *);
@@ -410,8 +414,24 @@ __extern int caca_set_dither_algorithm(caca_dither_t *, char const *);
 __extern char const * const * caca_get_dither_algorithm_list(caca_dither_t
                                                               const *);
 __extern char const * caca_get_dither_algorithm(caca_dither_t const *);
+__extern int caca_set_dither_threads(caca_dither_t *, int);
+__extern int caca_get_dither_threads(caca_dither_t const *);
+__extern int caca_set_dither_coherence(caca_dither_t *, int);
+__extern int caca_get_dither_coherence(caca_dither_t const *);
+__extern int caca_set_dither_frame(caca_dither_t *, int);
+__extern int caca_get_dither_frame(caca_dither_t const *);
 __extern int caca_dither_bitmap(caca_canvas_t *, int, int, int, int,
                          caca_dither_t const *, void const *);
+__extern int caca_dither_bitmap_to_buffer(uint32_t *, uint32_t *, int, int,
+                                          int, caca_dither_t const *,
+                                          void const *);
+__extern int caca_dither_bitmap_region(caca_canvas_t *, int, int, int, int,
+                                       caca_dither_t const *, void const *,
+                                       int, int, int, int);
+__extern int caca_begin_dither_bitmap(caca_canvas_t *, int, int, int, int,
+                                     caca_dither_t *);
+__extern int caca_feed_dither_bitmap(caca_dither_t *, void const *, int);
+__extern int caca_end_dither_bitmap(caca_dither_t *);
 __extern int caca_free_dither(caca_dither_t *);
 /*  @} */
 
@@ -437,6 +457,14 @@ __extern int caca_get_font_height(caca_font_t const *);
 __extern uint32_t const *caca_get_font_blocks(caca_font_t const *);
 __extern int caca_render_canvas(caca_canvas_t const *, caca_font_t const *,
                                  void *, int, int, int);
+__extern int caca_render_canvas_region(caca_canvas_t const *,
+                                        caca_font_t const *, void *,
+                                        int, int, int, int, int, int, int);
+__extern int caca_render_canvas_dirty(caca_canvas_t const *,
+                                       caca_font_t const *, void *,
+                                       int, int, int);
+__extern int caca_set_font_threads(caca_font_t *, int);
+__extern int caca_get_font_threads(caca_font_t const *);
 __extern int caca_free_font(caca_font_t *);
 /*  @} */
 
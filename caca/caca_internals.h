@@ -19,11 +19,13 @@
 
 typedef struct caca_timer caca_timer_t;
 typedef struct caca_privevent caca_privevent_t;
+typedef struct caca_pool caca_pool_t;
 
 #if !defined(_DOXYGEN_SKIP_ME)
 #   define STAT_VALUES 32
 #   define EVENTBUF_LEN 10
 #   define MAX_DIRTY_COUNT 8
+#   define MAX_THREADS 64
 #endif
 
 struct caca_frame
@@ -256,6 +258,19 @@ extern void _push_event(caca_display_t *, caca_privevent_t *);
 extern int _pop_event(caca_display_t *, caca_privevent_t *);
 #endif
 
+/* Internal dither functions */
+#if !defined(__KERNEL__)
+extern void _caca_get_dither_transfer(caca_dither_t const *, int *, int *);
+#endif
+
+/* Internal thread pool functions */
+#if defined(HAVE_PTHREAD_H)
+extern caca_pool_t *_caca_create_pool(int);
+extern void _caca_destroy_pool(caca_pool_t *);
+extern int _caca_run_pool(caca_pool_t *, void (*)(void const *),
+                          void const *, size_t, int);
+#endif
+
 /* Internal window functions */
 extern void _caca_set_term_title(char const *);
 
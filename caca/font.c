@@ -25,6 +25,10 @@
 #   include <string.h>
 #endif
 
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
 #include "caca.h"
 #include "caca_internals.h"
 
@@ -34,6 +38,17 @@
 
 /* Helper structures for font loading */
 #if !defined(_DOXYGEN_SKIP_ME)
+#   define PAGE_BITS 8 /* the BMP index has pages of 256 characters */
+#   define PAGE_SIZE (1 << PAGE_BITS)
+#   define BMP_PAGES (0x10000 >> PAGE_BITS)
+#   define NO_GLYPH 0xffffffff
+#   define GLYPH_CACHE_MAX (4 << 20) /* bytes of unpacked glyphs */
+
+/* What is known of a glyph's coverage */
+#   define GLYPH_MIXED 0
+#   define GLYPH_BLANK 1 /* only background */
+#   define GLYPH_FULL 2 /* only foreground */
+
 struct font_header
 {
     uint32_t control_size, data_size;
@@ -62,8 +77,56 @@ struct caca_font
     struct glyph_info *glyph_list;
     uint8_t *font_data;
 
+    /* Glyph index of every BMP character, or NO_GLYPH. Pages without any
+     * glyph are NULL; the others point into bmp_index. */
+    uint32_t *bmp_pages[BMP_PAGES];
+    uint32_t *bmp_index;
+
+    /* Glyphs unpacked to 8 bits per pixel when the font is loaded: the
+     * offset of each glyph in cache_data, and its coverage. The offsets
+     * and coverages live in the cache_offset block, as does the data
+     * unless the font is already 8 bits per pixel. The cache is never
+     * written afterwards, so several threads may render with the font. */
+    uint32_t *cache_offset;
+    uint8_t *cache_coverage;
+    uint8_t *cache_data;
+
+    /* Multithreading */
+    int threads;
+    caca_pool_t *pool;
+
     uint8_t *private;
 };
+
+/* A band of canvas rows rendered by one thread: the cells of these rows
+ * that belong to any of the rectangles */
+struct render_band
+{
+    caca_canvas_t const *cv;
+    caca_font_t const *f;
+    uint8_t *buf;
+    int width, height, pitch;
+    int const (*rects)[4]; /* x, y, width, height, in cells */
+    int nrects;
+    int ymin, ymax;
+    uint8_t *tmp; /* unpacking buffer when there is no glyph cache */
+};
+#endif
+
+static int build_glyph_index(caca_font_t *);
+static struct glyph_info const *find_glyph(caca_font_t const *, uint32_t);
+static void build_glyph_cache(caca_font_t *);
+static uint8_t const *get_glyph(caca_font_t const *,
+                                struct glyph_info const *, uint8_t *, int *);
+static void blend_glyph(uint8_t *, int, uint8_t const *, int, int,
+                        uint8_t const *, int);
+static int clip_rect(caca_canvas_t const *, caca_font_t const *,
+                     int, int, int *);
+static int render_rects(caca_canvas_t const *, caca_font_t const *, void *,
+                        int, int, int, int const (*)[4], int);
+static void render_band(struct render_band const *);
+#if defined(HAVE_PTHREAD_H)
+static void render_band_job(void const *);
 #endif
 
 #define DECLARE_UNPACKGLYPH(bpp) \
@@ -286,6 +349,20 @@ caca_font_t *caca_load_font(void const *data, size_t size)
     }
 
     f->font_data = f->private + 4 + f->header.control_size;
+    f->threads = 1;
+    f->pool = NULL;
+
+    if(build_glyph_index(f) < 0)
+    {
+        free(f->glyph_list);
+        free(f->user_block_list);
+        free(f->block_list);
+        free(f);
+        seterrno(ENOMEM);
+        return NULL;
+    }
+
+    build_glyph_cache(f);
 
     return f;
 }
@@ -366,6 +443,72 @@ uint32_t const *caca_get_font_blocks(caca_font_t const *f)
     return (uint32_t const *)f->user_block_list;
 }
 
+/** \brief Set the number of rendering threads
+ *
+ *  Tell the renderer how many threads caca_render_canvas(),
+ *  caca_render_canvas_region() and caca_render_canvas_dirty() may use
+ *  with this font. The canvas rows are split into bands of roughly equal
+ *  height that are rendered concurrently. Each cell is drawn
+ *  independently, so the output does not depend on the number of threads.
+ *  The default value is 1, meaning that all the work is done in the
+ *  calling thread.
+ *
+ *  If some glyphs of the font are taller than a cell, they would overlap
+ *  the rows of the next band, so canvases are rendered in the calling
+ *  thread only, whatever the number of threads. None of the built-in
+ *  fonts has such glyphs.
+ *
+ *  The threads are started by this function and wait for work until the
+ *  thread count changes or the font is freed. If several threads render
+ *  with the same font at once, only one of them uses the worker threads.
+ *  If libcaca was built without thread support, the value is stored but
+ *  the rendering is always done in the calling thread.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Thread count was lower than 1 or greater than 64.
+ *
+ *  \param f The font, as returned by caca_load_font()
+ *  \param threads The maximum number of threads to use.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_set_font_threads(caca_font_t *f, int threads)
+{
+    if(threads < 1 || threads > MAX_THREADS)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    if(threads == f->threads)
+        return 0;
+
+    f->threads = threads;
+
+#if defined(HAVE_PTHREAD_H)
+    /* The calling thread renders bands too, so it needs one less worker */
+    if(f->pool)
+        _caca_destroy_pool(f->pool);
+    f->pool = threads > 1 ? _caca_create_pool(threads - 1) : NULL;
+#endif
+
+    return 0;
+}
+
+/** \brief Get the number of rendering threads
+ *
+ *  Return the maximum number of threads used to render canvases with the
+ *  given font.
+ *
+ *  This function never fails.
+ *
+ *  \param f The font, as returned by caca_load_font()
+ *  \return The number of threads.
+ */
+int caca_get_font_threads(caca_font_t const *f)
+{
+    return f->threads;
+}
+
 /** \brief Free a font structure.
  *
  *  This function frees all data allocated by caca_load_font(). The
@@ -380,6 +523,12 @@ uint32_t const *caca_get_font_blocks(caca_font_t const *f)
  */
 int caca_free_font(caca_font_t *f)
 {
+#if defined(HAVE_PTHREAD_H)
+    if(f->pool)
+        _caca_destroy_pool(f->pool);
+#endif
+    free(f->cache_offset);
+    free(f->bmp_index);
     free(f->glyph_list);
     free(f->user_block_list);
     free(f->block_list);
@@ -415,8 +564,93 @@ int caca_free_font(caca_font_t *f)
 int caca_render_canvas(caca_canvas_t const *cv, caca_font_t const *f,
                         void *buf, int width, int height, int pitch)
 {
-    uint8_t *glyph = NULL;
-    int x, y, xmax, ymax;
+    return caca_render_canvas_region(cv, f, buf, width, height, pitch,
+                                     0, 0, cv->width, cv->height);
+}
+
+/** \brief Render part of the canvas onto an image buffer.
+ *
+ *  This function renders the cells of a rectangle of the canvas on an
+ *  image buffer laid out as for caca_render_canvas(): each cell is drawn
+ *  at the same place, and the pixels of the other cells are left
+ *  untouched. This can be used to update an image after part of the canvas
+ *  changed, or to split the rendering of a large canvas into tiles.
+ *
+ *  The rectangle is clipped to the canvas. A fullwidth character is drawn
+ *  if either of its cells is in the rectangle.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Specified width, height or pitch is invalid.
+ *  - \c ENOMEM Not enough memory to allocate the temporary buffers.
+ *
+ *  \param cv The canvas to render
+ *  \param f The font, as returned by caca_load_font()
+ *  \param buf The image buffer
+ *  \param width The width (in pixels) of the image buffer
+ *  \param height The height (in pixels) of the image buffer
+ *  \param pitch The pitch (in bytes) of an image buffer line.
+ *  \param x X coordinate of the rectangle, in canvas cells.
+ *  \param y Y coordinate of the rectangle, in canvas cells.
+ *  \param w Width of the rectangle, in canvas cells.
+ *  \param h Height of the rectangle, in canvas cells.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_render_canvas_region(caca_canvas_t const *cv, caca_font_t const *f,
+                              void *buf, int width, int height, int pitch,
+                              int x, int y, int w, int h)
+{
+    int rect[1][4];
+
+    if(width < 0 || height < 0 || pitch < 0)
+    {
+        seterrno(EINVAL);
+        return -1;
+    }
+
+    rect[0][0] = x;
+    rect[0][1] = y;
+    rect[0][2] = w;
+    rect[0][3] = h;
+
+    if(clip_rect(cv, f, width, height, rect[0]) < 0)
+        return 0;
+
+    return render_rects(cv, f, buf, width, height, pitch, rect, 1);
+}
+
+/** \brief Render the changed cells of the canvas onto an image buffer.
+ *
+ *  This function updates an image buffer that holds a rendering of the
+ *  canvas with the same font, as done by caca_render_canvas(), by only
+ *  rendering the cells of the canvas's dirty rectangles. When few cells
+ *  changed since the buffer was last updated, for instance in a mostly
+ *  static user interface, this is much faster than rendering the whole
+ *  canvas again. All the dirty rectangles are rendered in one go, split
+ *  among the threads set with caca_set_font_threads().
+ *
+ *  The dirty rectangle list is not cleared, so that other buffers or a
+ *  display can be updated from the same canvas. Call
+ *  caca_clear_dirty_rect_list() once they are all up to date. If dirty
+ *  rectangles are disabled, or the canvas was resized, the whole buffer
+ *  should be rendered again with caca_render_canvas() instead.
+ *
+ *  If an error occurs, -1 is returned and \b errno is set accordingly:
+ *  - \c EINVAL Specified width, height or pitch is invalid.
+ *  - \c ENOMEM Not enough memory to allocate the temporary buffers.
+ *
+ *  \param cv The canvas to render
+ *  \param f The font, as returned by caca_load_font()
+ *  \param buf The image buffer
+ *  \param width The width (in pixels) of the image buffer
+ *  \param height The height (in pixels) of the image buffer
+ *  \param pitch The pitch (in bytes) of an image buffer line.
+ *  \return 0 in case of success, -1 if an error occurred.
+ */
+int caca_render_canvas_dirty(caca_canvas_t const *cv, caca_font_t const *f,
+                             void *buf, int width, int height, int pitch)
+{
+    int rects[MAX_DIRTY_COUNT + 1][4];
+    int nrects = 0, i;
 
     if(width < 0 || height < 0 || pitch < 0)
     {
@@ -424,8 +658,28 @@ int caca_render_canvas(caca_canvas_t const *cv, caca_font_t const *f,
         return -1;
     }
 
-    if(f->header.bpp != 8)
-        glyph = malloc(f->header.width * 2 * f->header.height);
+    /* Dirty rectangles may overlap, in which case the shared cells are
+     * simply rendered twice */
+    for(i = 0; i < cv->ndirty; i++)
+    {
+        rects[nrects][0] = cv->dirty[i].xmin;
+        rects[nrects][1] = cv->dirty[i].ymin;
+        rects[nrects][2] = cv->dirty[i].xmax - cv->dirty[i].xmin + 1;
+        rects[nrects][3] = cv->dirty[i].ymax - cv->dirty[i].ymin + 1;
+
+        if(clip_rect(cv, f, width, height, rects[nrects]) == 0)
+            nrects++;
+    }
+
+    return render_rects(cv, f, buf, width, height, pitch, rects, nrects);
+}
+
+/* Clip a rectangle to the canvas cells that fit in the buffer. Return -1
+ * if nothing is left. */
+static int clip_rect(caca_canvas_t const *cv, caca_font_t const *f,
+                     int width, int height, int *r)
+{
+    int xmax, ymax;
 
     if(width < cv->width * f->header.width)
         xmax = width / f->header.width;
@@ -437,87 +691,489 @@ int caca_render_canvas(caca_canvas_t const *cv, caca_font_t const *f,
     else
         ymax = cv->height;
 
-    for(y = 0; y < ymax; y++)
+    if(r[2] > xmax - r[0])
+        r[2] = xmax - r[0];
+    if(r[3] > ymax - r[1])
+        r[3] = ymax - r[1];
+    if(r[0] < 0)
+    {
+        r[2] += r[0];
+        r[0] = 0;
+    }
+    if(r[1] < 0)
+    {
+        r[3] += r[1];
+        r[1] = 0;
+    }
+
+    return r[2] > 0 && r[3] > 0 ? 0 : -1;
+}
+
+/* Render the cells of a list of clipped rectangles. The rows they cover
+ * are split into bands with roughly as many rectangle rows each, and the
+ * bands are rendered with the font's threads if they are available or in
+ * the calling thread otherwise. Glyphs taller than a cell would reach the
+ * rows of the next band, so such fonts are rendered in a single band. */
+static int render_rects(caca_canvas_t const *cv, caca_font_t const *f,
+                        void *buf, int width, int height, int pitch,
+                        int const (*rects)[4], int nrects)
+{
+    struct render_band bands[MAX_THREADS];
+    uint8_t *tmp = NULL;
+    int ymin = cv->height, ymax = 0, total = 0, done = 0;
+    int nbands, i, k, y;
+
+    for(i = 0; i < nrects; i++)
+    {
+        if(rects[i][1] < ymin)
+            ymin = rects[i][1];
+        if(rects[i][1] + rects[i][3] > ymax)
+            ymax = rects[i][1] + rects[i][3];
+        total += rects[i][3];
+    }
+
+    if(!total)
+        return 0;
+
+    nbands = f->threads < ymax - ymin ? f->threads : ymax - ymin;
+#if !defined(HAVE_PTHREAD_H)
+    nbands = 1;
+#endif
+    if(f->header.maxheight > f->header.height)
+        nbands = 1;
+
+    /* Close band k once the rows seen so far reach its share */
+    bands[0].ymin = ymin;
+    for(k = 1, y = ymin; y < ymax && k < nbands; y++)
+    {
+        for(i = 0; i < nrects; i++)
+            if(y >= rects[i][1] && y < rects[i][1] + rects[i][3])
+                done++;
+
+        if(done * nbands >= total * k && y + 1 < ymax)
+        {
+            bands[k - 1].ymax = bands[k].ymin = y + 1;
+            k++;
+        }
+    }
+    bands[k - 1].ymax = ymax;
+    nbands = k;
+
+    if(f->header.bpp != 8 && !f->cache_offset)
+    {
+        tmp = malloc(nbands * f->header.maxwidth * f->header.maxheight);
+        if(!tmp)
+        {
+            seterrno(ENOMEM);
+            return -1;
+        }
+    }
+
+    for(i = 0; i < nbands; i++)
+    {
+        bands[i].cv = cv;
+        bands[i].f = f;
+        bands[i].buf = buf;
+        bands[i].width = width;
+        bands[i].height = height;
+        bands[i].pitch = pitch;
+        bands[i].rects = rects;
+        bands[i].nrects = nrects;
+        bands[i].tmp = tmp ? tmp + i * f->header.maxwidth
+                                     * f->header.maxheight : NULL;
+    }
+
+#if defined(HAVE_PTHREAD_H)
+    if(!f->pool || nbands < 2
+        || _caca_run_pool(f->pool, render_band_job, bands,
+                          sizeof(*bands), nbands) < 0)
+#endif
+    for(i = 0; i < nbands; i++)
+        render_band(&bands[i]);
+
+    free(tmp);
+
+    return 0;
+}
+
+/* Render the cells of a band. Glyphs that do not fit in the image buffer
+ * are skipped, and glyphs taller than a cell are cut at the bottom of
+ * their rectangle, so that the pixels of the other cells are not
+ * touched. */
+static void render_band(struct render_band const *b)
+{
+    caca_canvas_t const *cv = b->cv;
+    caca_font_t const *f = b->f;
+    int x, y, r;
+
+    for(y = b->ymin; y < b->ymax; y++)
+        for(r = 0; r < b->nrects; r++)
     {
-        for(x = 0; x < xmax; x++)
+        int const *rect = b->rects[r];
+        int endy;
+
+        if(y < rect[1] || y >= rect[1] + rect[3])
+            continue;
+
+        endy = (rect[1] + rect[3]) * f->header.height;
+
+        x = rect[0];
+
+        /* Draw the fullwidth character whose right half starts the row */
+        if(x > 0 && cv->chars[y * cv->width + x] == CACA_MAGIC_FULLWIDTH)
+            x--;
+
+        for( ; x < rect[0] + rect[2]; x++)
         {
+            uint8_t const *glyph;
             uint8_t argb[8];
             int starty = y * f->header.height;
             int startx = x * f->header.width;
             uint32_t ch = cv->chars[y * cv->width + x];
             uint32_t attr = cv->attrs[y * cv->width + x];
-            int b, i, j;
-            struct glyph_info *g;
-
-            /* Find the Unicode block where our glyph lies */
-            for(b = 0; b < f->header.blocks; b++)
-            {
-                if(ch < f->block_list[b].start)
-                {
-                    b = f->header.blocks;
-                    break;
-                }
-
-                if(ch < f->block_list[b].stop)
-                    break;
-            }
+            int coverage;
+            struct glyph_info const *g;
 
             /* Glyph not in font? Skip it. */
-            if(b == f->header.blocks)
+            g = find_glyph(f, ch);
+            if(!g)
                 continue;
 
-            g = &f->glyph_list[f->block_list[b].index
-                                + ch - f->block_list[b].start];
+            if(startx + g->width > b->width || starty + g->height > b->height)
+                continue;
 
             caca_attr_to_argb64(attr, argb);
 
             /* Step 1: unpack glyph */
-            switch(f->header.bpp)
-            {
-            case 8:
-                glyph = f->font_data + g->data_offset;
-                break;
-            case 4:
-                unpack_glyph4(glyph, f->font_data + g->data_offset,
-                              g->width * g->height);
-                break;
-            case 2:
-                unpack_glyph2(glyph, f->font_data + g->data_offset,
-                              g->width * g->height);
-                break;
-            case 1:
-                unpack_glyph1(glyph, f->font_data + g->data_offset,
-                              g->width * g->height);
-                break;
-            }
+            glyph = get_glyph(f, g, b->tmp, &coverage);
 
             /* Step 2: render glyph using colour attribute */
-            for(j = 0; j < g->height; j++)
-            {
-                uint8_t *line = buf;
-                line += (starty + j) * pitch + 4 * startx;
-
-                for(i = 0; i < g->width; i++)
-                {
-                    uint8_t *pixel = line + 4 * i;
-                    uint32_t p, q, t;
-
-                    p = glyph[j * g->width + i];
-                    q = 0xff - p;
-
-                    for(t = 0; t < 4; t++)
-                        pixel[t] = (((q * argb[t]) + (p * argb[4 + t])) / 0xf);
-                }
-            }
+            blend_glyph(b->buf + starty * b->pitch + 4 * startx, b->pitch,
+                        glyph, g->width, starty + g->height > endy
+                                          ? endy - starty : g->height,
+                        argb, coverage);
+        }
+    }
+}
+
+#if defined(HAVE_PTHREAD_H)
+static void render_band_job(void const *data)
+{
+    render_band(data);
+}
+#endif
+
+/* Build the direct lookup table of BMP characters. Characters beyond the
+ * BMP are rare enough for a binary search in the block list. */
+static int build_glyph_index(caca_font_t *f)
+{
+    uint8_t used[BMP_PAGES];
+    uint32_t *index;
+    uint32_t ch, page;
+    int b, count = 0;
+
+    memset(f->bmp_pages, 0, sizeof(f->bmp_pages));
+    f->bmp_index = NULL;
+
+    /* Find the pages that contain glyphs, then allocate them at once */
+    memset(used, 0, sizeof(used));
+    for(b = 0; b < f->header.blocks; b++)
+    {
+        uint32_t start = f->block_list[b].start;
+        uint32_t stop = f->block_list[b].stop;
+
+        if(stop > 0x10000)
+            stop = 0x10000;
+
+        for(page = start >> PAGE_BITS;
+            start < stop && page <= (stop - 1) >> PAGE_BITS; page++)
+        {
+            if(!used[page])
+                count++;
+            used[page] = 1;
         }
     }
 
-    if(f->header.bpp != 8)
-        free(glyph);
+    if(!count)
+        return 0;
+
+    index = malloc(count * PAGE_SIZE * sizeof(uint32_t));
+    if(!index)
+        return -1;
+
+    memset(index, 0xff, count * PAGE_SIZE * sizeof(uint32_t));
+    f->bmp_index = index;
+
+    for(page = 0; page < BMP_PAGES; page++)
+    {
+        if(!used[page])
+            continue;
+
+        f->bmp_pages[page] = index;
+        index += PAGE_SIZE;
+    }
+
+    for(b = 0; b < f->header.blocks; b++)
+    {
+        struct block_info const *bl = &f->block_list[b];
+
+        for(ch = bl->start; ch < bl->stop && ch < 0x10000; ch++)
+        {
+            uint32_t glyph = bl->index + ch - bl->start;
+
+            /* Blocks are checked to start inside the glyph list, but not
+             * to end inside it */
+            if(glyph < f->header.glyphs)
+                f->bmp_pages[ch >> PAGE_BITS][ch & (PAGE_SIZE - 1)] = glyph;
+        }
+    }
 
     return 0;
 }
 
+/* Find the glyph of a character, or NULL if the font does not have it */
+static struct glyph_info const *find_glyph(caca_font_t const *f, uint32_t ch)
+{
+    int lo, hi;
+
+    if(ch < 0x10000)
+    {
+        uint32_t const *page = f->bmp_pages[ch >> PAGE_BITS];
+        uint32_t glyph;
+
+        if(!page)
+            return NULL;
+
+        glyph = page[ch & (PAGE_SIZE - 1)];
+        return glyph == NO_GLYPH ? NULL : &f->glyph_list[glyph];
+    }
+
+    /* The blocks are sorted and do not overlap */
+    lo = 0;
+    hi = f->header.blocks;
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        struct block_info const *bl = &f->block_list[mid];
+
+        if(ch < bl->start)
+            hi = mid;
+        else if(ch >= bl->stop)
+            lo = mid + 1;
+        else if(bl->index + ch - bl->start < f->header.glyphs)
+            return &f->glyph_list[bl->index + ch - bl->start];
+        else
+            return NULL;
+    }
+
+    return NULL;
+}
+
+/* Unpack all the glyphs and find their coverage. Fonts that would need
+ * more than GLYPH_CACHE_MAX bytes, or a failed allocation, leave the cache
+ * empty: glyphs are then unpacked again for every cell. 8 bits per pixel
+ * fonts only need the offsets and coverages. */
+static void build_glyph_cache(caca_font_t *f)
+{
+    uint32_t i, size = 0;
+
+    f->cache_offset = NULL;
+
+    for(i = 0; i < f->header.glyphs && f->header.bpp != 8; i++)
+    {
+        uint32_t n = (uint32_t)f->glyph_list[i].width
+                      * f->glyph_list[i].height;
+
+        if(n > GLYPH_CACHE_MAX - size)
+            return;
+        size += n;
+    }
+
+    f->cache_offset = malloc(f->header.glyphs * (sizeof(uint32_t) + 1)
+                              + size);
+    if(!f->cache_offset)
+        return;
+
+    f->cache_coverage = (uint8_t *)(f->cache_offset + f->header.glyphs);
+
+    if(f->header.bpp == 8)
+        f->cache_data = f->font_data;
+    else
+        f->cache_data = f->cache_coverage + f->header.glyphs;
+
+    for(i = 0, size = 0; i < f->header.glyphs; i++)
+    {
+        struct glyph_info const *g = &f->glyph_list[i];
+        uint8_t *packed = f->font_data + g->data_offset;
+        uint8_t *glyph;
+        int j, n = g->width * g->height, min = 0xff, max = 0;
+
+        if(f->header.bpp == 8)
+            f->cache_offset[i] = g->data_offset;
+        else
+        {
+            f->cache_offset[i] = size;
+            size += n;
+        }
+
+        glyph = f->cache_data + f->cache_offset[i];
+
+        switch(f->header.bpp)
+        {
+        case 4:
+            unpack_glyph4(glyph, packed, n);
+            break;
+        case 2:
+            unpack_glyph2(glyph, packed, n);
+            break;
+        case 1:
+            unpack_glyph1(glyph, packed, n);
+            break;
+        }
+
+        for(j = 0; j < n; j++)
+        {
+            if(glyph[j] < min)
+                min = glyph[j];
+            if(glyph[j] > max)
+                max = glyph[j];
+        }
+
+        f->cache_coverage[i] = max == 0 ? GLYPH_BLANK
+                                : min == 0xff ? GLYPH_FULL : GLYPH_MIXED;
+    }
+}
+
+/* Get the 8 bits per pixel version of a glyph and its coverage, from the
+ * cache if there is one. Otherwise the glyph is unpacked into tmp and its
+ * coverage is not computed. */
+static uint8_t const *get_glyph(caca_font_t const *f,
+                                struct glyph_info const *g, uint8_t *tmp,
+                                int *coverage)
+{
+    uint8_t *packed = f->font_data + g->data_offset;
+    int n = g->width * g->height;
+
+    if(f->cache_offset)
+    {
+        uint32_t index = g - f->glyph_list;
+
+        *coverage = f->cache_coverage[index];
+        return f->cache_data + f->cache_offset[index];
+    }
+
+    *coverage = GLYPH_MIXED;
+
+    switch(f->header.bpp)
+    {
+    case 8:
+        return packed;
+    case 4:
+        unpack_glyph4(tmp, packed, n);
+        break;
+    case 2:
+        unpack_glyph2(tmp, packed, n);
+        break;
+    case 1:
+        unpack_glyph1(tmp, packed, n);
+        break;
+    }
+
+    return tmp;
+}
+
+/* Draw a w x h glyph at the given place of a 32-bit ARGB buffer, mixing
+ * the background and foreground colours of argb by its coverage:
+ *   (q * bg + p * fg) / 15 with p + q = 255
+ * Blank and full glyphs are solid rectangles. */
+static void blend_glyph(uint8_t *line, int pitch, uint8_t const *glyph,
+                        int w, int h, uint8_t const *argb, int coverage)
+{
+#if defined(__SSE2__)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const bias = _mm_set1_epi16(255 * 15);
+    __m128i const div15 = _mm_set1_epi16((short)0x8889);
+    __m128i diff, base;
+#endif
+    int i, j, t;
+
+    if(coverage == GLYPH_BLANK || coverage == GLYPH_FULL)
+    {
+        uint8_t const *color = argb + (coverage == GLYPH_FULL ? 4 : 0);
+        uint8_t pixel[4];
+
+        if(!w)
+            return;
+
+        for(t = 0; t < 4; t++)
+            pixel[t] = color[t] * 0x11;
+
+        for(i = 0; i < w; i++)
+            memcpy(line + 4 * i, pixel, 4);
+        for(j = 1; j < h; j++)
+            memcpy(line + j * pitch, line, 4 * w);
+
+        return;
+    }
+
+#if defined(__SSE2__)
+    /* The blend is 17 * bg + p * (fg - bg) / 15. Adding 255 * 15 makes
+     * the dividend non-negative, so that the division can be done by a
+     * multiplication; 17 * bg - 255 is added back afterwards. */
+    diff = _mm_setr_epi16(argb[4] - argb[0], argb[5] - argb[1],
+                          argb[6] - argb[2], argb[7] - argb[3],
+                          argb[4] - argb[0], argb[5] - argb[1],
+                          argb[6] - argb[2], argb[7] - argb[3]);
+    base = _mm_setr_epi16(argb[0] * 17 - 255, argb[1] * 17 - 255,
+                          argb[2] * 17 - 255, argb[3] * 17 - 255,
+                          argb[0] * 17 - 255, argb[1] * 17 - 255,
+                          argb[2] * 17 - 255, argb[3] * 17 - 255);
+#endif
+
+    for(j = 0; j < h; j++, line += pitch, glyph += w)
+    {
+        i = 0;
+
+#if defined(__SSE2__)
+        /* Four pixels at a time, with each coverage value spread over
+         * the four channels of its pixel */
+        for( ; i + 4 <= w; i += 4)
+        {
+            __m128i p, lo, hi;
+            uint32_t p4;
+
+            memcpy(&p4, glyph + i, 4);
+            p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(p4), zero);
+            p = _mm_unpacklo_epi16(p, p);
+            lo = _mm_unpacklo_epi32(p, p);
+            hi = _mm_unpackhi_epi32(p, p);
+
+            lo = _mm_add_epi16(_mm_mullo_epi16(lo, diff), bias);
+            hi = _mm_add_epi16(_mm_mullo_epi16(hi, diff), bias);
+            lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div15), 3);
+            hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div15), 3);
+            lo = _mm_add_epi16(lo, base);
+            hi = _mm_add_epi16(hi, base);
+
+            _mm_storeu_si128((__m128i *)(line + 4 * i),
+                             _mm_packus_epi16(lo, hi));
+        }
+#endif
+
+        for( ; i < w; i++)
+        {
+            uint8_t *pixel = line + 4 * i;
+            uint32_t p, q;
+
+            p = glyph[i];
+            q = 0xff - p;
+
+            for(t = 0; t < 4; t++)
+                pixel[t] = (((q * argb[t]) + (p * argb[4 + t])) / 0xf);
+        }
+    }
+}
+
 /*
  * XXX: The following functions are aliases.
  */
@@ -0,0 +1,169 @@
+/*
+ *  libcaca       Colour ASCII-Art library
+ *  Copyright (c) 2002-2010 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This library is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What The Fuck You Want
+ *  To Public License, Version 2, as published by Sam Hocevar. See
+ *  http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+/*
+ *  This file contains the worker thread pool shared by the dithering and
+ *  font rendering functions.
+ */
+
+#include "config.h"
+
+#if !defined(__KERNEL__)
+#   include <stdlib.h>
+#   if defined(HAVE_PTHREAD_H)
+#       include <pthread.h>
+#   endif
+#endif
+
+#include "caca.h"
+#include "caca_internals.h"
+
+#if defined(HAVE_PTHREAD_H)
+/* Worker threads kept by a dither or a font for the lifetime of its thread
+ * setting. The calling thread publishes an array of jobs, then it and the
+ * workers take them one at a time until none is left. Only one thread at
+ * a time may publish jobs; the others have to do theirs alone. */
+struct caca_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    pthread_t tids[MAX_THREADS];
+    int count; /* number of worker threads */
+    int quit, busy;
+
+    void (*func)(void const *);
+    char const *jobs;
+    size_t size;
+    int njobs, next, pending; /* published, taken and unfinished jobs */
+};
+
+/* Run the published jobs until none is left. Called with the pool lock
+ * held, which is released while running them. */
+static void take_jobs(caca_pool_t *p)
+{
+    while(p->next < p->njobs)
+    {
+        void const *job = p->jobs + p->next++ * p->size;
+
+        pthread_mutex_unlock(&p->lock);
+        p->func(job);
+        pthread_mutex_lock(&p->lock);
+
+        if(--p->pending == 0)
+            pthread_cond_signal(&p->done);
+    }
+}
+
+static void *pool_thread(void *data)
+{
+    caca_pool_t *p = data;
+
+    pthread_mutex_lock(&p->lock);
+    while(!p->quit)
+    {
+        if(p->next < p->njobs)
+            take_jobs(p);
+        else
+            pthread_cond_wait(&p->start, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/* Start count worker threads. If some cannot be started, the pool works
+ * with fewer threads; it is NULL if none could be started. */
+caca_pool_t *_caca_create_pool(int count)
+{
+    caca_pool_t *p = malloc(sizeof(caca_pool_t));
+
+    if(!p)
+        return NULL;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->quit = p->busy = 0;
+    p->jobs = NULL;
+    p->njobs = p->next = p->pending = 0;
+
+    if(count > MAX_THREADS)
+        count = MAX_THREADS;
+
+    for(p->count = 0; p->count < count; p->count++)
+        if(pthread_create(&p->tids[p->count], NULL, pool_thread, p))
+            break;
+
+    if(!p->count)
+    {
+        _caca_destroy_pool(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+void _caca_destroy_pool(caca_pool_t *p)
+{
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for(i = 0; i < p->count; i++)
+        pthread_join(p->tids[i], NULL);
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+/* Call func on each of the njobs jobs of size bytes starting at jobs, with
+ * the pool's threads and the calling thread, and wait until they are all
+ * done. Return -1 without running anything if another thread is already
+ * using the pool. */
+int _caca_run_pool(caca_pool_t *p, void (*func)(void const *),
+                   void const *jobs, size_t size, int njobs)
+{
+    pthread_mutex_lock(&p->lock);
+
+    if(p->busy)
+    {
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+
+    p->busy = 1;
+    p->func = func;
+    p->jobs = jobs;
+    p->size = size;
+    p->njobs = njobs;
+    p->next = 0;
+    p->pending = njobs;
+    pthread_cond_broadcast(&p->start);
+
+    take_jobs(p);
+    while(p->pending)
+        pthread_cond_wait(&p->done, &p->lock);
+
+    p->jobs = NULL;
+    p->njobs = p->next = 0;
+    p->busy = 0;
+
+    pthread_mutex_unlock(&p->lock);
+
+    return 0;
+}
+#endif
@@ -203,6 +203,8 @@ class Dither(_Dither):
                        the background
                      + "full16" or "default": use the 16 ANSI colours for both the
                        characters and the background (default)
+                     + "rgb12" or "truecolor": use 12-bit ARGB colours for both
+                       the characters and the background
         """
         _lib.caca_set_dither_color.argtypes = [_Dither, ctypes.c_char_p]
         _lib.caca_set_dither_color.restype  = ctypes.c_int
@@ -246,6 +248,12 @@ class Dither(_Dither):
                        also present in the CP437 codepage available on DOS and VGA.
                      + "blocks": use Unicode quarter-cell block combinations.
                        These characters are only found in the Unicode set.
+                     + "quadrants": draw the shape of 2x2 subcells with the
+                       Unicode quadrant blocks.
+                     + "sextants": draw the shape of 2x3 subcells with the
+                       Unicode sextant blocks.
+                     + "braille": draw the shape of 2x4 subcells with the
+                       Unicode braille patterns.
         """
         _lib.caca_set_dither_charset.argtypes = [_Dither, ctypes.c_char_p]
         _lib.caca_set_dither_charset.restype  = ctypes.c_int
@@ -287,8 +295,14 @@ class Dither(_Dither):
                      + "ordered2": use a 2x2 Bayer matrix for dithering.
                      + "ordered4": use a 4x4 Bayer matrix for dithering.
                      + "ordered8": use a 8x8 Bayer matrix for dithering.
+                     + "ordered16": use a 16x16 Bayer matrix for dithering.
+                     + "bluenoise": use a 64x64 blue noise map for dithering.
                      + "random": use random dithering.
                      + "fstein": use Floyd-Steinberg dithering (default).
+                     + "atkinson": use Atkinson dithering.
+                     + "jarvis": use Jarvis-Judice-Ninke dithering.
+                     + "stucki": use Stucki dithering.
+                     + "sierra": use three-line Sierra dithering.
         """
         _lib.caca_set_dither_algorithm.argtypes = [_Dither, ctypes.c_char_p]
         _lib.caca_set_dither_algorithm.restype  = ctypes.c_int
@@ -13,11 +13,16 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "caca.h"
 
 #define BLIT_LOOPS 1000000
 #define PUTCHAR_LOOPS 50000000
+#define DITHER_LOOPS 200
+#define RENDER_LOOPS 100
+#define SUITE_LOOPS 5
 
 #define TIME(desc, code) \
 { \
@@ -67,14 +72,416 @@ static void putchars(int optim)
     caca_free_canvas(cv);
 }
 
+static void dither(char const *algo, char const *antialias, int frame)
+{
+    caca_canvas_t *cv;
+    caca_dither_t *d;
+    uint32_t *pixels;
+    int i, x, y;
+
+    pixels = malloc(640 * 480 * sizeof(uint32_t));
+    for(y = 0; y < 480; y++)
+        for(x = 0; x < 640; x++)
+            pixels[y * 640 + x] = ((x * 255 / 639) << 16)
+                                   | ((y * 255 / 479) << 8)
+                                   | ((x ^ y) & 0xff);
+
+    cv = caca_create_canvas(160, 60);
+    d = caca_create_dither(32, 640, 480, 640 * 4,
+                           0x00ff0000, 0x0000ff00, 0x000000ff, 0x0);
+    caca_set_dither_algorithm(d, algo);
+    caca_set_dither_antialias(d, antialias);
+    caca_set_dither_frame(d, frame);
+    for (i = 0; i < DITHER_LOOPS; i++)
+        caca_dither_bitmap(cv, 0, 0, 160, 60, d, pixels);
+    caca_free_dither(d);
+    caca_free_canvas(cv);
+    free(pixels);
+}
+
+static void render(int dirty)
+{
+    static uint32_t const chars[] =
+    {
+        ' ', 'a', '#', 0x2580 /* ▀ */, 0x2588 /* █ */, 0x2591 /* ░ */,
+        0x2500 /* ─ */, 0x00e9 /* é */, 0x0416 /* Ж */, 0x03a9 /* Ω */,
+    };
+    caca_canvas_t *cv;
+    caca_font_t *f;
+    uint8_t *buf;
+    int i, x, y, w, h;
+
+    cv = caca_create_canvas(200, 60);
+    for(y = 0; y < 60; y++)
+        for(x = 0; x < 200; x++)
+        {
+            caca_set_color_ansi(cv, (x + y) & 15, (x * y) & 15);
+            caca_put_char(cv, x, y, chars[(x * 7 + y * 3) % 10]);
+        }
+
+    f = caca_load_font(caca_get_font_list()[0], 0);
+    w = 200 * caca_get_font_width(f);
+    h = 60 * caca_get_font_height(f);
+    buf = malloc(4 * w * h);
+    if(dirty)
+    {
+        /* Only a status line changes between frames */
+        caca_render_canvas(cv, f, buf, w, h, 4 * w);
+        caca_clear_dirty_rect_list(cv);
+        for(i = 0; i < RENDER_LOOPS; i++)
+        {
+            caca_printf(cv, 0, 59, "frame %i", i);
+            caca_render_canvas_dirty(cv, f, buf, w, h, 4 * w);
+            caca_clear_dirty_rect_list(cv);
+        }
+    }
+    else
+        for(i = 0; i < RENDER_LOOPS; i++)
+            caca_render_canvas(cv, f, buf, w, h, 4 * w);
+    free(buf);
+    caca_free_font(f);
+    caca_free_canvas(cv);
+}
+
+/*
+ * Dither quality and throughput suite: "bench dither [--all] [filter...]"
+ * dithers a few synthetic images at several sizes. By default, each
+ * algorithm, colour mode, character set and antialiasing mode is tried
+ * with the other settings left to their defaults; with --all, every
+ * combination of them is run, which takes about 70 times longer. Only the
+ * combinations whose fields match all the given filters are run, eg.
+ * "bench dither fstein 160x60". Each line reports the dithering speed and
+ * the PSNR between the canvas rendered with the default font and the
+ * source image, both averaged down to 2x4 samples per character cell.
+ */
+
+static char const * const images[] =
+{
+    "gradient", "hues", "rings", "shapes", "clouds", NULL
+};
+
+static struct
+{
+    char const *name;
+    int w, h, cw, ch;
+}
+const sizes[] =
+{
+    { "80x30", 320, 240, 80, 30 },
+    { "160x60", 640, 480, 160, 60 },
+    { "240x90", 1920, 1080, 240, 90 },
+    { NULL, 0, 0, 0, 0 },
+};
+
+static uint32_t rgb(int r, int g, int b)
+{
+    r = r < 0 ? 0 : r > 255 ? 255 : r;
+    g = g < 0 ? 0 : g > 255 ? 255 : g;
+    b = b < 0 ? 0 : b > 255 ? 255 : b;
+
+    return (r << 16) | (g << 8) | b;
+}
+
+/* Build one of the test images. They are computed rather than loaded so
+ * that the suite does not depend on any image file or decoder. */
+static uint32_t *make_image(char const *name, int w, int h)
+{
+    uint32_t *pixels = malloc(w * h * sizeof(uint32_t));
+    uint8_t lattice[17][17];
+    int x, y, i, j;
+    uint32_t seed = 1;
+
+    if(!pixels)
+        return NULL;
+
+    for(j = 0; j < 17; j++)
+        for(i = 0; i < 17; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            lattice[j][i] = seed >> 24;
+        }
+
+    for(y = 0; y < h; y++)
+        for(x = 0; x < w; x++)
+    {
+        int u = x * 1536 / w, v = y * 255 / (h - 1);
+        uint32_t p;
+
+        if(!strcmp(name, "gradient"))
+        {
+            /* Smooth ramps in each channel */
+            p = rgb(x * 255 / (w - 1), v, (x + y) * 255 / (w + h - 2));
+        }
+        else if(!strcmp(name, "hues"))
+        {
+            /* Saturated hues from left to right, darker downwards */
+            int f = u % 256, r, g, b;
+
+            switch(u / 256)
+            {
+                case 0: r = 255; g = f; b = 0; break;
+                case 1: r = 255 - f; g = 255; b = 0; break;
+                case 2: r = 0; g = 255; b = f; break;
+                case 3: r = 0; g = 255 - f; b = 255; break;
+                case 4: r = f; g = 0; b = 255; break;
+                default: r = 255; g = 0; b = 255 - f; break;
+            }
+            p = rgb(r * (255 - v) / 255, g * (255 - v) / 255,
+                    b * (255 - v) / 255);
+        }
+        else if(!strcmp(name, "rings"))
+        {
+            /* Zone plate: frequency increases away from the centre */
+            int dx = (x - w / 2) * 512 / w, dy = (y - h / 2) * 512 / w;
+            int t = ((dx * dx + dy * dy) / 16) & 511;
+
+            t = t < 256 ? t : 511 - t;
+            p = rgb(t, t, t);
+        }
+        else if(!strcmp(name, "shapes"))
+        {
+            /* Flat coloured areas with sharp edges and thin lines */
+            int cx = x * 8 / w, cy = y * 6 / h;
+
+            if(x % (w / 16) < 2 || y % (h / 12) < 2)
+                p = rgb(255, 255, 255);
+            else if((cx + cy) & 1)
+                p = rgb(cx * 32, 255 - cy * 40, 128);
+            else
+                p = rgb(20, cy * 40, 255 - cx * 32);
+        }
+        else
+        {
+            /* Clouds: bilinear interpolation of a random lattice */
+            int lx = x * 16 / w, ly = y * 16 / h;
+            int fx = x * 16 * 256 / w - lx * 256;
+            int fy = y * 16 * 256 / h - ly * 256;
+            int top = lattice[ly][lx] * (256 - fx) + lattice[ly][lx + 1] * fx;
+            int bot = lattice[ly + 1][lx] * (256 - fx)
+                       + lattice[ly + 1][lx + 1] * fx;
+            int t = (top * (256 - fy) + bot * fy) >> 16;
+
+            p = rgb(t / 2, t, 255 - t / 2);
+        }
+
+        pixels[y * w + x] = p;
+    }
+
+    return pixels;
+}
+
+/* Compute 10 * log10(x) without relying on the math library */
+static double decibels(double x)
+{
+    double t, t2, r, ln;
+    int i, e = 0;
+
+    while(x >= 10.0) { x /= 10.0; e++; }
+    while(x < 1.0) { x *= 10.0; e--; }
+
+    /* ln(x) = 2 * (t + t^3/3 + t^5/5 + ...) with t = (x-1)/(x+1) */
+    t = (x - 1.0) / (x + 1.0);
+    t2 = t * t;
+    ln = r = t;
+    for(i = 3; i < 99; i += 2)
+    {
+        r *= t2;
+        ln += r / i;
+    }
+
+    return 10.0 * (e + 2.0 * ln / 2.302585092994046);
+}
+
+/* Render the canvas and compare it to the source image */
+static double psnr(caca_canvas_t *cv, caca_font_t *f,
+                   uint32_t const *pixels, int w, int h)
+{
+    int cw = caca_get_canvas_width(cv), ch = caca_get_canvas_height(cv);
+    int rw = cw * caca_get_font_width(f), rh = ch * caca_get_font_height(f);
+    int gw = 2 * cw, gh = 4 * ch;
+    uint8_t *buf;
+    double error = 0.0;
+    int i, j, x, y, c;
+
+    /* Glyphs missing from the font are left black */
+    buf = malloc(4 * rw * rh);
+    if(!buf)
+        return 0.0;
+    memset(buf, 0, 4 * rw * rh);
+    caca_render_canvas(cv, f, buf, rw, rh, 4 * rw);
+
+    for(j = 0; j < gh; j++)
+        for(i = 0; i < gw; i++)
+    {
+        int sum[2][3], n[2];
+
+        memset(sum, 0, sizeof(sum));
+        n[0] = n[1] = 0;
+
+        for(y = j * h / gh; y < (j + 1) * h / gh; y++)
+            for(x = i * w / gw; x < (i + 1) * w / gw; x++)
+            {
+                uint32_t p = pixels[y * w + x];
+
+                sum[0][0] += (p >> 16) & 0xff;
+                sum[0][1] += (p >> 8) & 0xff;
+                sum[0][2] += p & 0xff;
+                n[0]++;
+            }
+
+        /* The rendered pixels are stored as A, R, G, B bytes */
+        for(y = j * rh / gh; y < (j + 1) * rh / gh; y++)
+            for(x = i * rw / gw; x < (i + 1) * rw / gw; x++)
+            {
+                for(c = 0; c < 3; c++)
+                    sum[1][c] += buf[4 * (y * rw + x) + 1 + c];
+                n[1]++;
+            }
+
+        for(c = 0; c < 3; c++)
+        {
+            double diff = (double)sum[0][c] / n[0] - (double)sum[1][c] / n[1];
+            error += diff * diff;
+        }
+    }
+
+    free(buf);
+
+    error /= 3.0 * gw * gh;
+    return error > 0.0 ? decibels(255.0 * 255.0 / error) : 99.0;
+}
+
+static int matches(int argc, char *argv[], char const * const *fields)
+{
+    int i, j;
+
+    for(i = 0; i < argc; i++)
+    {
+        for(j = 0; fields[j]; j++)
+            if(!strcmp(argv[i], fields[j]))
+                break;
+        if(!fields[j])
+            return 0;
+    }
+
+    return 1;
+}
+
+static void dither_suite(int all, int argc, char *argv[])
+{
+    char const * const *algos = caca_get_dither_algorithm_list(NULL);
+    char const * const *colors = caca_get_dither_color_list(NULL);
+    char const * const *charsets = caca_get_dither_charset_list(NULL);
+    char const * const *antialiases = caca_get_dither_antialias_list(NULL);
+    caca_display_t *dummy = caca_create_display_with_driver(NULL, "null");
+    caca_font_t *f = caca_load_font(caca_get_font_list()[0], 0);
+    char const *defaults[4];
+    int s, im, a, c, cs, aa, i;
+
+    printf("%-7s %-9s %-10s %-9s %-10s %-10s %11s %6s\n", "size", "image",
+           "algorithm", "colour", "charset", "antialias", "cells/s", "PSNR");
+
+    for(s = 0; sizes[s].name; s++)
+        for(im = 0; images[im]; im++)
+    {
+        int w = sizes[s].w, h = sizes[s].h;
+        int cw = sizes[s].cw, ch = sizes[s].ch;
+        caca_canvas_t *cv = caca_create_canvas(cw, ch);
+        caca_dither_t *d = caca_create_dither(32, w, h, w * 4, 0x00ff0000,
+                                              0x0000ff00, 0x000000ff, 0x0);
+        uint32_t *pixels = NULL;
+
+        defaults[0] = caca_get_dither_algorithm(d);
+        defaults[1] = caca_get_dither_color(d);
+        defaults[2] = caca_get_dither_charset(d);
+        defaults[3] = caca_get_dither_antialias(d);
+
+        for(a = 0; algos[a]; a += 2)
+            for(c = 0; colors[c]; c += 2)
+                for(cs = 0; charsets[cs]; cs += 2)
+                    for(aa = 0; antialiases[aa]; aa += 2)
+        {
+            char const *fields[7];
+            int usec, changed = 0;
+
+            fields[0] = sizes[s].name;
+            fields[1] = images[im];
+            fields[2] = algos[a];
+            fields[3] = colors[c];
+            fields[4] = charsets[cs];
+            fields[5] = antialiases[aa];
+            fields[6] = NULL;
+
+            for(i = 0; i < 4; i++)
+                changed += strcmp(fields[2 + i], defaults[i]) != 0;
+
+            if((!all && changed > 1) || !matches(argc, argv, fields))
+                continue;
+
+            if(!pixels)
+                pixels = make_image(images[im], w, h);
+
+            caca_set_dither_algorithm(d, algos[a]);
+            caca_set_dither_color(d, colors[c]);
+            caca_set_dither_charset(d, charsets[cs]);
+            caca_set_dither_antialias(d, antialiases[aa]);
+
+            caca_refresh_display(dummy);
+            for(i = 0; i < SUITE_LOOPS; i++)
+                caca_dither_bitmap(cv, 0, 0, cw, ch, d, pixels);
+            caca_refresh_display(dummy);
+            usec = caca_get_display_time(dummy);
+
+            printf("%-7s %-9s %-10s %-9s %-10s %-10s %11.0f %6.2f\n",
+                   fields[0], fields[1], fields[2], fields[3], fields[4],
+                   fields[5], usec > 0 ? 1e6 * SUITE_LOOPS * cw * ch / usec
+                                       : 0.0,
+                   psnr(cv, f, pixels, w, h));
+            fflush(stdout);
+        }
+
+        free(pixels);
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    caca_free_font(f);
+    caca_free_display(dummy);
+}
+
 int main(int argc, char *argv[])
 {
+    char const * const *algos;
+    char desc[64];
+    int i;
+
+    if(argc > 1 && !strcmp(argv[1], "dither"))
+    {
+        if(argc > 2 && !strcmp(argv[2], "--all"))
+            dither_suite(1, argc - 3, argv + 3);
+        else
+            dither_suite(0, argc - 2, argv + 2);
+        return 0;
+    }
+
     TIME("blit no mask, no clear", blit(0, 0));
     TIME("blit no mask, clear", blit(0, 1));
     TIME("blit mask, no clear", blit(1, 0));
     TIME("blit mask, clear", blit(1, 1));
     TIME("putchars, no optim", putchars(0));
     TIME("putchars, optim", putchars(1));
+
+    algos = caca_get_dither_algorithm_list(NULL);
+    for (i = 0; algos[i]; i += 2)
+    {
+        sprintf(desc, "dither %s", algos[i]);
+        TIME(desc, dither(algos[i], "prefilter", 0));
+    }
+    TIME("dither integral", dither("fstein", "integral", 0));
+    TIME("dither integral, one frame", dither("fstein", "integral", 1));
+
+    TIME("render", render(0));
+    TIME("render, dirty rectangles", render(1));
     return 0;
 }
 
@@ -0,0 +1,1036 @@
+/*
+ *  caca-test     testsuite program for libcaca
+ *  Copyright (c) 2010 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This program is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What The Fuck You Want
+ *  To Public License, Version 2, as published by Sam Hocevar. See
+ *  http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestCase.h>
+#include <cppunit/TestSuite.h>
+
+#include "caca.h"
+
+extern "C" {
+#include "caca_internals.h"
+}
+
+class DitherTest : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(DitherTest);
+    CPPUNIT_TEST(test_to_buffer);
+    CPPUNIT_TEST(test_region);
+    CPPUNIT_TEST(test_region_diffusion);
+    CPPUNIT_TEST(test_tiles);
+    CPPUNIT_TEST(test_stream);
+    CPPUNIT_TEST(test_invert);
+    CPPUNIT_TEST(test_threads);
+    CPPUNIT_TEST(test_coherence);
+    CPPUNIT_TEST(test_coherence_alpha);
+    CPPUNIT_TEST(test_integral);
+    CPPUNIT_TEST(test_integral_frame);
+    CPPUNIT_TEST(test_transfer);
+    CPPUNIT_TEST(test_rgb12);
+    CPPUNIT_TEST(test_metrics);
+    CPPUNIT_TEST(test_kernels);
+    CPPUNIT_TEST(test_threshold_maps);
+    CPPUNIT_TEST(test_subcells);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    DitherTest() : CppUnit::TestCase("Dither Test") {}
+
+    void setUp()
+    {
+        int x, y;
+
+        /* Colour ramps with a few sharp edges */
+        for(y = 0; y < BH; y++)
+            for(x = 0; x < BW; x++)
+                pixels[y * BW + x] = ((x * 255 / (BW - 1)) << 16)
+                                      | ((y * 255 / (BH - 1)) << 8)
+                                      | ((x ^ y) & 0x30 ? 0xc0 : 0x20);
+    }
+
+    void tearDown() {}
+
+    void test_to_buffer()
+    {
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        uint32_t chars[CW * CH], attrs[CW * CH];
+        int a, x, y;
+
+        cv = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        for(a = 0; algos[a]; a++)
+        {
+            /* Check that the buffers hold what the canvas would show. */
+            caca_set_dither_algorithm(d, algos[a]);
+            caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+            CPPUNIT_ASSERT_EQUAL(0, caca_dither_bitmap_to_buffer(chars, attrs,
+                                                CW, CH, CW, d, pixels));
+
+            for(y = 0; y < CH; y++)
+                for(x = 0; x < CW; x++)
+                {
+                    CPPUNIT_ASSERT_EQUAL(caca_get_char(cv, x, y),
+                                         chars[y * CW + x]);
+                    CPPUNIT_ASSERT_EQUAL(caca_get_attr(cv, x, y),
+                                         attrs[y * CW + x]);
+                }
+        }
+
+        /* Check that invalid sizes are refused. */
+        CPPUNIT_ASSERT_EQUAL(-1, caca_dither_bitmap_to_buffer(chars, attrs,
+                                                CW, CH, CW - 1, d, pixels));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_region()
+    {
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d;
+        int a, x, y;
+
+        cv = caca_create_canvas(CW + 4, CH + 4);
+        cv2 = caca_create_canvas(CW + 4, CH + 4);
+        d = new_dither();
+
+        for(a = 0; algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, algos[a]);
+            setUp();
+            caca_dither_bitmap(cv2, 2, 1, CW, CH, d, pixels);
+
+            /* Change part of the bitmap and only redraw that part. */
+            for(y = 10; y < 26; y++)
+                for(x = 20; x < 36; x++)
+                    pixels[y * BW + x] ^= 0x00ffffff;
+            CPPUNIT_ASSERT_EQUAL(0, caca_dither_bitmap_region(cv2, 2, 1,
+                                         CW, CH, d, pixels, 20, 10, 16, 16));
+
+            /* Check that the result is the same as a full redraw. */
+            caca_dither_bitmap(cv, 2, 1, CW, CH, d, pixels);
+            CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        }
+
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_region_diffusion()
+    {
+        static char const * const diffusion_algos[] =
+            { "fstein", "atkinson", NULL };
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d;
+        caca_font_t *f;
+        uint8_t *buf, *buf2;
+        int a, x, y, xmin, xmax, ymin, ymax, fw, fh, w, h;
+
+        cv = caca_create_canvas(CW + 4, CH + 4);
+        cv2 = caca_create_canvas(CW + 4, CH + 4);
+        d = new_dither();
+        f = caca_load_font(caca_get_font_list()[0], 0);
+        fw = caca_get_font_width(f);
+        fh = caca_get_font_height(f);
+        w = (CW + 4) * fw;
+        h = (CH + 4) * fh;
+        buf = new uint8_t[4 * w * h];
+        buf2 = new uint8_t[4 * w * h];
+
+        /* The cells covering the bitmap rectangle (20, 10) - (36, 26) */
+        for(xmin = 0; (xmin + 1) * BW / CW <= 20; xmin++) ;
+        for(xmax = xmin; xmax * BW / CW < 36; xmax++) ;
+        for(ymin = 0; (ymin + 1) * BH / CH <= 10; ymin++) ;
+        for(ymax = ymin; ymax * BH / CH < 26; ymax++) ;
+        xmin += 2; xmax += 2; ymin += 1; ymax += 1;
+
+        for(a = 0; diffusion_algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, diffusion_algos[a]);
+            setUp();
+            caca_dither_bitmap(cv, 2, 1, CW, CH, d, pixels);
+            caca_dither_bitmap(cv2, 2, 1, CW, CH, d, pixels);
+
+            /* Redraw part of the unchanged bitmap. The margin cells are
+             * dithered to get the incoming error, but they are not drawn:
+             * outside the region, the canvas must match a full redraw. */
+            CPPUNIT_ASSERT_EQUAL(0, caca_dither_bitmap_region(cv2, 2, 1,
+                                         CW, CH, d, pixels, 20, 10, 16, 16));
+
+            for(y = 0; y < CH + 4; y++)
+                for(x = 0; x < CW + 4; x++)
+                    if(x < xmin || x >= xmax || y < ymin || y >= ymax)
+                    {
+                        CPPUNIT_ASSERT_EQUAL(caca_get_char(cv, x, y),
+                                             caca_get_char(cv2, x, y));
+                        CPPUNIT_ASSERT_EQUAL(caca_get_attr(cv, x, y),
+                                             caca_get_attr(cv2, x, y));
+                    }
+
+            /* Inside the region, the diffused error starts from the margin
+             * instead of from the edges of the bitmap, so cells differ.
+             * Check that there is no seam: the average brightness of each
+             * row and column of the region, and of the whole region, stays
+             * within 8 and 4 levels out of 255 of a full redraw. */
+            caca_render_canvas(cv, f, buf, w, h, 4 * w);
+            caca_render_canvas(cv2, f, buf2, w, h, 4 * w);
+
+            for(y = ymin; y < ymax; y++)
+                CPPUNIT_ASSERT(abs(brightness(buf, w, fw, fh, xmin, y,
+                                              xmax, y + 1)
+                                    - brightness(buf2, w, fw, fh, xmin, y,
+                                                 xmax, y + 1)) <= 8);
+            for(x = xmin; x < xmax; x++)
+                CPPUNIT_ASSERT(abs(brightness(buf, w, fw, fh, x, ymin,
+                                              x + 1, ymax)
+                                    - brightness(buf2, w, fw, fh, x, ymin,
+                                                 x + 1, ymax)) <= 8);
+            CPPUNIT_ASSERT(abs(brightness(buf, w, fw, fh, xmin, ymin,
+                                          xmax, ymax)
+                                - brightness(buf2, w, fw, fh, xmin, ymin,
+                                             xmax, ymax)) <= 4);
+        }
+
+        delete[] buf2;
+        delete[] buf;
+        caca_free_font(f);
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_tiles()
+    {
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d;
+        int a, x, y;
+
+        cv = caca_create_canvas(CW, CH);
+        cv2 = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        for(a = 0; algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, algos[a]);
+            caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+
+            /* Check that tiles that do not fall on cell boundaries
+             * add up to the whole bitmap. */
+            caca_clear_canvas(cv2);
+            for(y = 0; y < BH; y += 20)
+                for(x = 0; x < BW; x += 25)
+                    caca_dither_bitmap_region(cv2, 0, 0, CW, CH, d, pixels,
+                                              x, y, 25, 20);
+            CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        }
+
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_stream()
+    {
+        /* Error diffusion goes through the same rows in the same order */
+        static char const * const stream_algos[] =
+            { "none", "ordered4", "fstein", NULL };
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d;
+        int a, y, n;
+
+        cv = caca_create_canvas(CW + 4, CH + 4);
+        cv2 = caca_create_canvas(CW + 4, CH + 4);
+        d = new_dither();
+
+        for(a = 0; stream_algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, stream_algos[a]);
+            caca_dither_bitmap(cv, 2, 1, CW, CH, d, pixels);
+
+            /* Check that feeding the bitmap in uneven chunks of lines
+             * gives the same result as dithering it at once. */
+            caca_clear_canvas(cv2);
+            CPPUNIT_ASSERT_EQUAL(0, caca_begin_dither_bitmap(cv2, 2, 1,
+                                                             CW, CH, d));
+            for(y = 0, n = 1; y < BH; y += n, n = n % 7 + 1)
+                CPPUNIT_ASSERT_EQUAL(0, caca_feed_dither_bitmap(d,
+                                 pixels + y * BW, y + n < BH ? n : BH - y));
+            CPPUNIT_ASSERT_EQUAL(0, caca_end_dither_bitmap(d));
+            CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        }
+
+        /* Check that feeding without a bitmap in progress fails. */
+        CPPUNIT_ASSERT_EQUAL(-1, caca_feed_dither_bitmap(d, pixels, 1));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_invert()
+    {
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d, *d2;
+        uint8_t index[16 * 16];
+        int i;
+
+        for(i = 0; i < 256; i++)
+            index[i] = i;
+
+        cv = caca_create_canvas(8, 8);
+        cv2 = caca_create_canvas(8, 8);
+        d = new_palette_dither();
+        d2 = new_palette_dither();
+
+        /* Check that inverting after a first draw changes the output... */
+        caca_dither_bitmap(cv, 0, 0, 8, 8, d, index);
+        caca_dither_bitmap(cv2, 0, 0, 8, 8, d2, index);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        caca_set_dither_gamma(d, -1.0);
+        caca_dither_bitmap(cv, 0, 0, 8, 8, d, index);
+        CPPUNIT_ASSERT(!same_canvas(cv, cv2));
+
+        /* ...and gives the same result as inverting before it. */
+        caca_free_dither(d2);
+        d2 = new_palette_dither();
+        caca_set_dither_gamma(d2, -1.0);
+        caca_dither_bitmap(cv2, 0, 0, 8, 8, d2, index);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        caca_free_dither(d2);
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_threads()
+    {
+        /* Algorithms whose output does not depend on the bands */
+        static char const * const thread_algos[] =
+            { "none", "ordered2", "ordered8", "ordered16", "bluenoise", NULL };
+        static char const * const diffusion_algos[] =
+            { "fstein", "atkinson", "jarvis", NULL };
+        static int const threads[] = { 4, 2, 3, 1, 0 };
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d, *d2;
+        caca_font_t *f;
+        uint8_t *buf, *buf2;
+        int a, t, y, fw, fh, w, h;
+
+        cv = caca_create_canvas(CW + 4, CH + 4);
+        cv2 = caca_create_canvas(CW + 4, CH + 4);
+        d = new_dither();
+        d2 = new_dither();
+
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_threads(d2, 0));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_threads(d2));
+
+        for(a = 0; thread_algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, thread_algos[a]);
+            caca_set_dither_algorithm(d2, thread_algos[a]);
+            caca_dither_bitmap(cv, 2, 1, CW, CH, d, pixels);
+
+            /* Check that the thread count can change between calls and
+             * that the canvas does not depend on it. */
+            for(t = 0; threads[t]; t++)
+            {
+                CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_threads(d2,
+                                                                threads[t]));
+                CPPUNIT_ASSERT_EQUAL(threads[t], caca_get_dither_threads(d2));
+                caca_clear_canvas(cv2);
+                caca_dither_bitmap(cv2, 2, 1, CW, CH, d2, pixels);
+                CPPUNIT_ASSERT(same_canvas(cv, cv2));
+            }
+        }
+
+        /* Error diffusion algorithms dither a few lines above each band
+         * to collect the error entering it, which is close to the one
+         * computed by the previous band but not equal: check that the
+         * brightness of each line does not change by more than 12 levels
+         * out of 255, and that of the whole bitmap by more than 2. */
+        f = caca_load_font(caca_get_font_list()[0], 0);
+        fw = caca_get_font_width(f);
+        fh = caca_get_font_height(f);
+        w = (CW + 4) * fw;
+        h = (CH + 4) * fh;
+        buf = new uint8_t[4 * w * h];
+        buf2 = new uint8_t[4 * w * h];
+
+        for(a = 0; diffusion_algos[a]; a++)
+        {
+            caca_set_dither_algorithm(d, diffusion_algos[a]);
+            caca_set_dither_algorithm(d2, diffusion_algos[a]);
+            caca_set_dither_threads(d, 1);
+            caca_clear_canvas(cv);
+            caca_dither_bitmap(cv, 2, 1, CW, CH, d, pixels);
+            caca_render_canvas(cv, f, buf, w, h, 4 * w);
+
+            for(t = 0; threads[t]; t++)
+            {
+                caca_set_dither_threads(d2, threads[t]);
+                caca_clear_canvas(cv2);
+                caca_dither_bitmap(cv2, 2, 1, CW, CH, d2, pixels);
+                caca_render_canvas(cv2, f, buf2, w, h, 4 * w);
+
+                for(y = 1; y < CH + 1; y++)
+                    CPPUNIT_ASSERT(abs(brightness(buf, w, fw, fh, 2, y,
+                                                  CW + 2, y + 1)
+                                        - brightness(buf2, w, fw, fh, 2, y,
+                                                     CW + 2, y + 1)) <= 12);
+                CPPUNIT_ASSERT(abs(brightness(buf, w, fw, fh, 2, 1,
+                                              CW + 2, CH + 1)
+                                    - brightness(buf2, w, fw, fh, 2, 1,
+                                                 CW + 2, CH + 1)) <= 2);
+            }
+        }
+
+        delete[] buf2;
+        delete[] buf;
+        caca_free_font(f);
+        caca_free_dither(d2);
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_coherence()
+    {
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d;
+        int i;
+
+        cv = caca_create_canvas(CW, CH);
+        cv2 = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_dither_coherence(d, -1));
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_coherence(d, 64));
+        CPPUNIT_ASSERT_EQUAL(64, caca_get_dither_coherence(d));
+        caca_set_dither_algorithm(d, "fstein");
+
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        caca_blit(cv2, 0, 0, cv, NULL);
+
+        /* Check that the same frame is drawn again without any change. */
+        caca_clear_dirty_rect_list(cv);
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv));
+
+        /* Check that changes below the threshold are ignored. */
+        for(i = 0; i < BW * BH; i++)
+            pixels[i] ^= (i & 3) ? 0x000101 : 0x010000;
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dirty_rect_count(cv));
+
+        /* Check that changes above the threshold are drawn. */
+        for(i = 0; i < BW * 8; i++)
+            pixels[i] ^= 0x808080;
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT(!same_canvas(cv, cv2));
+        CPPUNIT_ASSERT(caca_get_dirty_rect_count(cv) > 0);
+
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_coherence_alpha()
+    {
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d, *d2;
+        int x, y;
+
+        cv = caca_create_canvas(CW, CH);
+        cv2 = caca_create_canvas(CW, CH);
+        d = caca_create_dither(32, BW, BH, 4 * BW, 0x00ff0000,
+                               0x0000ff00, 0x000000ff, 0xff000000);
+        d2 = caca_create_dither(32, BW, BH, 4 * BW, 0x00ff0000,
+                                0x0000ff00, 0x000000ff, 0xff000000);
+        caca_set_dither_algorithm(d, "none");
+        caca_set_dither_algorithm(d2, "none");
+        caca_set_dither_coherence(d, 1000);
+
+        /* An opaque bitmap with an almost opaque square in the middle */
+        for(y = 0; y < BH; y++)
+            for(x = 0; x < BW; x++)
+                pixels[y * BW + x] |= (x >= 16 && x < 48 && y >= 16 && y < 32)
+                                       ? 0x7c000000 : 0xff000000;
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+
+        /* Check that cells becoming opaque are drawn even though their
+         * colour barely changed. */
+        for(y = 16; y < 32; y++)
+            for(x = 16; x < 48; x++)
+                pixels[y * BW + x] += 0x08000000;
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        caca_free_dither(d2);
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_integral()
+    {
+        static char const * const integral_algos[] =
+        {
+            "none", "ordered2", "ordered4", "ordered8", "ordered16",
+            "bluenoise", "fstein", "atkinson", NULL
+        };
+        static char const * const colors[] = { "full16", "gray", NULL };
+        caca_canvas_t *cv, *cv2;
+        caca_dither_t *d, *d2;
+        int a, c, i;
+
+        cv = caca_create_canvas(CW, CH);
+        cv2 = caca_create_canvas(CW, CH);
+        d = new_dither();
+        d2 = new_dither();
+        caca_set_dither_antialias(d, "prefilter");
+        caca_set_dither_antialias(d2, "integral");
+
+        for(a = 0; integral_algos[a]; a++)
+            for(c = 0; colors[c]; c++)
+        {
+            caca_set_dither_algorithm(d, integral_algos[a]);
+            caca_set_dither_algorithm(d2, integral_algos[a]);
+            caca_set_dither_color(d, colors[c]);
+            caca_set_dither_color(d2, colors[c]);
+
+            /* Check that the summed-area table gives the same box
+             * averages as the prefilter... */
+            setUp();
+            caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+            caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+            CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+            /* ...and that it is not reused when the same buffer is
+             * given again with different contents. */
+            for(i = 0; i < BW * BH; i++)
+                pixels[i] = ~pixels[i] & 0x00ffffff;
+            caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+            caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+            CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        }
+
+        caca_free_dither(d2);
+        caca_free_dither(d);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_integral_frame()
+    {
+        caca_canvas_t *cv, *cv2, *cv3;
+        caca_dither_t *d, *d2;
+        int i;
+
+        cv = caca_create_canvas(CW, CH);
+        cv2 = caca_create_canvas(CW, CH);
+        cv3 = caca_create_canvas(CW, CH);
+        d = new_dither();
+        d2 = new_dither();
+        caca_set_dither_antialias(d2, "integral");
+        caca_set_dither_threads(d, 3);
+        caca_set_dither_threads(d2, 3);
+
+        CPPUNIT_ASSERT_EQUAL(0, caca_get_dither_frame(d2));
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_dither_frame(d2, 1));
+        CPPUNIT_ASSERT_EQUAL(1, caca_get_dither_frame(d2));
+
+        /* Check that the table built by the band threads is right... */
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        /* ...that it is reused while the frame number does not change,
+         * even though the bitmap did... */
+        for(i = 0; i < BW * BH; i++)
+            pixels[i] = ~pixels[i] & 0x00ffffff;
+        caca_dither_bitmap(cv3, 0, 0, CW, CH, d2, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv2, cv3));
+
+        /* ...and that a new frame number or a new gamma value rebuild it.
+         * Region redraws use the table of the current frame. */
+        caca_set_dither_frame(d2, 2);
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+        caca_dither_bitmap_region(cv, 0, 0, CW, CH, d, pixels, 8, 8, 16, 16);
+        caca_dither_bitmap_region(cv2, 0, 0, CW, CH, d2, pixels, 8, 8, 16, 16);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        caca_set_dither_gamma(d, 0.5);
+        caca_set_dither_gamma(d2, 0.5);
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        caca_dither_bitmap(cv2, 0, 0, CW, CH, d2, pixels);
+        CPPUNIT_ASSERT(same_canvas(cv, cv2));
+
+        caca_free_dither(d2);
+        caca_free_dither(d);
+        caca_free_canvas(cv3);
+        caca_free_canvas(cv2);
+        caca_free_canvas(cv);
+    }
+
+    void test_transfer()
+    {
+        /* Gamma, contrast and brightness */
+        static float const settings[][3] =
+        {
+            { 0.3, 1.0, 1.0 }, { 2.2, 1.0, 1.0 }, { 4.0, 1.0, 1.0 },
+            { 1.0, 1.5, 1.0 }, { 1.0, 1.0, 0.75 }, { 0.7, 1.3, 1.2 },
+            { 1.8, 0.6, 1.1 },
+        };
+        int fixed[4096], flt[4096];
+        caca_dither_t *d;
+        unsigned int n;
+        int i;
+
+        for(n = 0; n < sizeof(settings) / sizeof(*settings); n++)
+        {
+            d = new_dither();
+            caca_set_dither_gamma(d, settings[n][0]);
+            caca_set_dither_contrast(d, settings[n][1]);
+            caca_set_dither_brightness(d, settings[n][2]);
+
+            /* Check that the fixed-point table is within 4 levels out of
+             * 4095 of the floating-point one. */
+            _caca_get_dither_transfer(d, fixed, flt);
+            for(i = 0; i < 4096; i++)
+                CPPUNIT_ASSERT(fixed[i] - flt[i] <= 4
+                                && flt[i] - fixed[i] <= 4);
+
+            caca_free_dither(d);
+        }
+    }
+
+    void test_rgb12()
+    {
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        uint32_t bg[CW * CH];
+        int x, y, i, colors = 0;
+
+        cv = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        check_setting(d, caca_set_dither_color, caca_get_dither_color,
+                      caca_get_dither_color_list, "rgb12");
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT(valid_chars(cv, 0x20, 0x7e));
+
+        /* Check that the colours are ARGB values rather than ANSI ones,
+         * and that there are more than 16 of them. */
+        for(y = 0; y < CH; y++)
+            for(x = 0; x < CW; x++)
+            {
+                uint32_t attr = caca_get_attr(cv, x, y);
+
+                CPPUNIT_ASSERT(((attr >> 4) & 0x3fff) >= 0x3800);
+                CPPUNIT_ASSERT(((attr >> 18) & 0x3fff) >= 0x3800);
+
+                for(i = 0; i < colors; i++)
+                    if(bg[i] == attr >> 18)
+                        break;
+                if(i == colors)
+                    bg[colors++] = attr >> 18;
+            }
+        CPPUNIT_ASSERT(colors > 16);
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_metrics()
+    {
+        static char const * const metrics[] = { "rgb", "yuv", "lab", NULL };
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        int m, i;
+
+        cv = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        CPPUNIT_ASSERT(!strcmp("rgb", caca_get_dither_metric(d)));
+
+        for(m = 0; metrics[m]; m++)
+            check_setting(d, caca_set_dither_metric, caca_get_dither_metric,
+                          caca_get_dither_metric_list, metrics[m]);
+
+        /* #20c020 is about as far from green (#008000) as from light
+         * green (#00ff00) in RGB, but its lightness is much closer to that
+         * of green. In the "16" colour mode, the foreground colour is the
+         * nearest palette entry. */
+        for(i = 0; i < BW * BH; i++)
+            pixels[i] = 0x20c020;
+        caca_set_dither_algorithm(d, "none");
+        caca_set_dither_color(d, "16");
+
+        caca_set_dither_metric(d, "rgb");
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT_EQUAL((uint8_t)CACA_LIGHTGREEN,
+                             caca_attr_to_ansi_fg(caca_get_attr(cv, 0, 0)));
+        CPPUNIT_ASSERT(same_attrs(cv));
+
+        caca_set_dither_metric(d, "lab");
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+        CPPUNIT_ASSERT_EQUAL((uint8_t)CACA_GREEN,
+                             caca_attr_to_ansi_fg(caca_get_attr(cv, 0, 0)));
+        CPPUNIT_ASSERT(same_attrs(cv));
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_kernels()
+    {
+        static char const * const kernels[] =
+            { "atkinson", "jarvis", "stucki", "sierra", NULL };
+        static int const greys[] = { 0x20, 0xe0, 0 };
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        int k;
+
+        cv = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        for(k = 0; kernels[k]; k++)
+            check_setting(d, caca_set_dither_algorithm,
+                          caca_get_dither_algorithm,
+                          caca_get_dither_algorithm_list, kernels[k]);
+
+        /* With the grey levels of "fullgray" and the "blocks" glyphs, a
+         * cell shows one of a few levels. Mid-grey lies halfway between
+         * two of them, so the diffused error has no bias: the cells must
+         * average to mid-grey, unlike without dithering. */
+        caca_set_dither_color(d, "fullgray");
+        caca_set_dither_charset(d, "blocks");
+        CPPUNIT_ASSERT(abs(grey_level(cv, d, "atkinson", 0x80)
+                            - 0x808) <= 0x29);
+        CPPUNIT_ASSERT(abs(grey_level(cv, d, "none", 0x80) - 0x808) > 0x29);
+
+        /* Elsewhere, Atkinson dithering only diffuses 6/8 of the error, so
+         * that the cells average to a level between the Floyd-Steinberg
+         * one, which is the closest to the bitmap, and the one without
+         * dithering. */
+        for(k = 0; greys[k]; k++)
+        {
+            int none = grey_level(cv, d, "none", greys[k]);
+            int fstein = grey_level(cv, d, "fstein", greys[k]);
+            int atkinson = grey_level(cv, d, "atkinson", greys[k]);
+            int level = greys[k] * 0xfff / 0xff;
+
+            CPPUNIT_ASSERT(abs(fstein - level) < abs(atkinson - level));
+            CPPUNIT_ASSERT((none < atkinson && atkinson < fstein)
+                            || (fstein < atkinson && atkinson < none));
+        }
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_threshold_maps()
+    {
+        static char const * const maps[] = { "ordered16", "bluenoise", NULL };
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        int m;
+
+        cv = caca_create_canvas(CW, CH);
+        d = new_dither();
+
+        /* Mid-grey lies halfway between two of the levels a "fullgray"
+         * cell can show with the "blocks" charset: the threshold map must
+         * light about half of the cells, where no dithering lights them
+         * all. */
+        caca_set_dither_color(d, "fullgray");
+        caca_set_dither_charset(d, "blocks");
+        CPPUNIT_ASSERT_EQUAL(100, grey_coverage(cv, d, "none", 0x80));
+
+        for(m = 0; maps[m]; m++)
+        {
+            int coverage;
+
+            check_setting(d, caca_set_dither_algorithm,
+                          caca_get_dither_algorithm,
+                          caca_get_dither_algorithm_list, maps[m]);
+            coverage = grey_coverage(cv, d, maps[m], 0x80);
+            CPPUNIT_ASSERT(coverage >= 45 && coverage <= 55);
+        }
+
+        caca_free_dither(d);
+        caca_free_canvas(cv);
+    }
+
+    void test_subcells()
+    {
+        static char const * const charsets[] =
+            { "quadrants", "sextants", "braille", NULL };
+        /* Lines of subcells of each set, and the glyph drawn for a cell
+         * where only one subcell is lit, going through the subcells row
+         * by row */
+        static int const lines[] = { 2, 3, 4 };
+        static uint32_t const glyphs[][8] =
+        {
+            { 0x2598, 0x259d, 0x2596, 0x2597 },
+            { 0x1fb00, 0x1fb01, 0x1fb03, 0x1fb07, 0x1fb0f, 0x1fb1e },
+            { 0x2801, 0x2808, 0x2802, 0x2810,
+              0x2804, 0x2820, 0x2840, 0x2880 },
+        };
+        caca_canvas_t *cv;
+        caca_dither_t *d;
+        uint32_t cell[8];
+        int c, i;
+
+        cv = caca_create_canvas(1, 1);
+
+        for(c = 0; charsets[c]; c++)
+        {
+            /* One pixel per subcell */
+            d = caca_create_dither(32, 2, lines[c], 8, 0x00ff0000,
+                                   0x0000ff00, 0x000000ff, 0x0);
+            check_setting(d, caca_set_dither_charset, caca_get_dither_charset,
+                          caca_get_dither_charset_list, charsets[c]);
+            caca_set_dither_algorithm(d, "none");
+
+            for(i = 0; i < 2 * lines[c]; i++)
+            {
+                uint32_t attr;
+
+                memset(cell, 0, sizeof(cell));
+                cell[i] = 0xffffff;
+                caca_dither_bitmap(cv, 0, 0, 1, 1, d, cell);
+
+                attr = caca_get_attr(cv, 0, 0);
+                CPPUNIT_ASSERT_EQUAL(glyphs[c][i], caca_get_char(cv, 0, 0));
+                CPPUNIT_ASSERT_EQUAL((uint8_t)CACA_WHITE,
+                                     caca_attr_to_ansi_fg(attr));
+                CPPUNIT_ASSERT_EQUAL((uint8_t)CACA_BLACK,
+                                     caca_attr_to_ansi_bg(attr));
+            }
+
+            caca_free_dither(d);
+        }
+
+        caca_free_canvas(cv);
+    }
+
+private:
+    /* Check that a setting can be selected, is listed and read back, and
+     * that an unknown name is refused without changing it. */
+    static void check_setting(caca_dither_t *d,
+                              int (*set)(caca_dither_t *, char const *),
+                              char const *(*get)(caca_dither_t const *),
+                              char const * const *(*list)
+                                                   (caca_dither_t const *),
+                              char const *name)
+    {
+        char const * const *names = list(d);
+        int i;
+
+        for(i = 0; names[i] && strcmp(names[i], name); i += 2)
+            ;
+        CPPUNIT_ASSERT(names[i] != NULL);
+
+        CPPUNIT_ASSERT_EQUAL(0, set(d, name));
+        CPPUNIT_ASSERT(!strcmp(name, get(d)));
+
+        errno = 0;
+        CPPUNIT_ASSERT_EQUAL(-1, set(d, "nonexistent"));
+        CPPUNIT_ASSERT_EQUAL(EINVAL, errno);
+        CPPUNIT_ASSERT(!strcmp(name, get(d)));
+    }
+
+    /* Check that every cell holds a space or a character from the given
+     * range, and that not all of them are spaces */
+    static bool valid_chars(caca_canvas_t *cv, uint32_t lo, uint32_t hi)
+    {
+        int x, y, drawn = 0;
+
+        for(y = 0; y < caca_get_canvas_height(cv); y++)
+            for(x = 0; x < caca_get_canvas_width(cv); x++)
+            {
+                uint32_t ch = caca_get_char(cv, x, y);
+
+                if(ch == ' ')
+                    continue;
+                if(ch < lo || ch > hi)
+                    return false;
+                drawn++;
+            }
+
+        return drawn > 0;
+    }
+
+    /* Dither a flat grey bitmap with the "fullgray" colour mode and the
+     * "blocks" charset, and return the average 12-bit level of the cells */
+    int grey_level(caca_canvas_t *cv, caca_dither_t *d, char const *algo,
+                   int grey)
+    {
+        int x, y, sum = 0;
+
+        dither_grey(cv, d, algo, grey);
+
+        for(y = 0; y < CH; y++)
+            for(x = 0; x < CW; x++)
+                sum += cell_level(cv, x, y);
+
+        return sum / (CW * CH);
+    }
+
+    /* Same as grey_level(), but return the percentage of cells lighter
+     * than the bitmap */
+    int grey_coverage(caca_canvas_t *cv, caca_dither_t *d, char const *algo,
+                      int grey)
+    {
+        int x, y, lit = 0;
+
+        dither_grey(cv, d, algo, grey);
+
+        for(y = 0; y < CH; y++)
+            for(x = 0; x < CW; x++)
+                if(cell_level(cv, x, y) > grey * 0xfff / 0xff)
+                    lit++;
+
+        return lit * 100 / (CW * CH);
+    }
+
+    void dither_grey(caca_canvas_t *cv, caca_dither_t *d, char const *algo,
+                     int grey)
+    {
+        int i;
+
+        for(i = 0; i < BW * BH; i++)
+            pixels[i] = grey * 0x010101;
+
+        caca_set_dither_algorithm(d, algo);
+        caca_dither_bitmap(cv, 0, 0, CW, CH, d, pixels);
+    }
+
+    /* The 12-bit level of a "fullgray" cell drawn with the "blocks"
+     * charset, mixing its foreground and background colours the way the
+     * dither does */
+    static int cell_level(caca_canvas_t *cv, int x, int y)
+    {
+        /* Levels of black, light grey, dark grey and white */
+        static int const levels[] = { 0, 0, 0, 0, 0, 0, 0, 0xaaa,
+                                      0x555, 0, 0, 0, 0, 0, 0, 0xfff };
+        uint32_t ch = caca_get_char(cv, x, y);
+        uint32_t attr = caca_get_attr(cv, x, y);
+        int fg = levels[caca_attr_to_ansi_fg(attr)];
+        int bg = levels[caca_attr_to_ansi_bg(attr)];
+        int n = ch == 0x2598 ? 1 : ch == 0x259a ? 2 : 0;
+
+        CPPUNIT_ASSERT(n || ch == ' ');
+
+        return (fg * n + bg * (7 - n)) / 7;
+    }
+
+    /* Check that every cell has the same attribute, as a flat bitmap
+     * gives without dithering */
+    static bool same_attrs(caca_canvas_t *cv)
+    {
+        int x, y;
+
+        for(y = 0; y < caca_get_canvas_height(cv); y++)
+            for(x = 0; x < caca_get_canvas_width(cv); x++)
+                if(caca_get_attr(cv, x, y) != caca_get_attr(cv, 0, 0))
+                    return false;
+
+        return true;
+    }
+
+    /* Average brightness of the rendered cells (x0, y0) - (x1, y1), from
+     * 0 to 255 */
+    static int brightness(uint8_t const *buf, int w, int fw, int fh,
+                          int x0, int y0, int x1, int y1)
+    {
+        int x, y, sum = 0;
+
+        for(y = y0 * fh; y < y1 * fh; y++)
+            for(x = x0 * fw; x < x1 * fw; x++)
+                sum += buf[4 * (y * w + x) + 1] + buf[4 * (y * w + x) + 2]
+                        + buf[4 * (y * w + x) + 3];
+
+        return sum / (3 * (x1 - x0) * fw * (y1 - y0) * fh);
+    }
+
+    static bool same_canvas(caca_canvas_t *cv, caca_canvas_t *cv2)
+    {
+        int x, y;
+
+        for(y = 0; y < caca_get_canvas_height(cv); y++)
+            for(x = 0; x < caca_get_canvas_width(cv); x++)
+                if(caca_get_char(cv, x, y) != caca_get_char(cv2, x, y)
+                    || caca_get_attr(cv, x, y) != caca_get_attr(cv2, x, y))
+                    return false;
+
+        return true;
+    }
+
+    static caca_dither_t *new_dither()
+    {
+        return caca_create_dither(32, BW, BH, 4 * BW, 0x00ff0000,
+                                  0x0000ff00, 0x000000ff, 0x0);
+    }
+
+    /* A 16x16 paletted dither that uses the cached palette cells */
+    static caca_dither_t *new_palette_dither()
+    {
+        uint32_t red[256], green[256], blue[256], alpha[256];
+        caca_dither_t *d;
+        int i;
+
+        for(i = 0; i < 256; i++)
+        {
+            red[i] = (i & 0xf0) * 0xfff / 0xf0;
+            green[i] = (i & 0x0f) * 0xfff / 0x0f;
+            blue[i] = (i * 7) & 0xfff;
+            alpha[i] = 0xfff;
+        }
+
+        d = caca_create_dither(8, 16, 16, 16, 0, 0, 0, 0);
+        caca_set_dither_palette(d, red, green, blue, alpha);
+        caca_set_dither_algorithm(d, "none");
+        caca_set_dither_antialias(d, "none");
+
+        return d;
+    }
+
+    static int const BW = 64, BH = 48, CW = 20, CH = 12;
+    static char const * const algos[];
+
+    uint32_t pixels[BW * BH];
+};
+
+/* Algorithms whose cells do not depend on their neighbours */
+char const * const DitherTest::algos[] = { "none", "ordered4", NULL };
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DitherTest);
+
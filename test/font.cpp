@@ -0,0 +1,335 @@
+/*
+ *  caca-test     testsuite program for libcaca
+ *  Copyright (c) 2010 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This program is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What The Fuck You Want
+ *  To Public License, Version 2, as published by Sam Hocevar. See
+ *  http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestCase.h>
+#include <cppunit/TestSuite.h>
+
+#include "caca.h"
+
+/* The built-in fonts, parsed directly by the reference renderer */
+#include "mono9.data"
+#include "monobold12.data"
+
+class FontTest : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(FontTest);
+    CPPUNIT_TEST(test_region);
+    CPPUNIT_TEST(test_threads);
+    CPPUNIT_TEST(test_dirty);
+    CPPUNIT_TEST(test_reference);
+    CPPUNIT_TEST(test_tall_glyphs);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    FontTest() : CppUnit::TestCase("Font Test") {}
+
+    void setUp()
+    {
+        static uint32_t const chars[] =
+        {
+            ' ', 'a', '#', 0x2580 /* ▀ */, 0x2588 /* █ */, 0x2591 /* ░ */,
+            0x2500 /* ─ */, 0x00e9 /* é */, 0x0416 /* Ж */, 0x03a9 /* Ω */,
+        };
+        int x, y;
+
+        cv = caca_create_canvas(WIDTH, HEIGHT);
+        for(y = 0; y < HEIGHT; y++)
+            for(x = 0; x < WIDTH; x++)
+            {
+                caca_set_color_ansi(cv, (x + y) & 15, (x * y) & 15);
+                caca_put_char(cv, x, y, chars[(x * 7 + y * 3) % 10]);
+            }
+
+        /* Fullwidth characters straddling the tile edges in test_region */
+        for(y = 0; y < HEIGHT; y++)
+            caca_put_char(cv, 4 + 5 * (y % 4), y, 0xff21 /* Ａ */);
+
+        f = caca_load_font(caca_get_font_list()[0], 0);
+        w = WIDTH * caca_get_font_width(f);
+        h = HEIGHT * caca_get_font_height(f);
+        buf = new uint8_t[4 * w * h];
+        buf2 = new uint8_t[4 * w * h];
+    }
+
+    void tearDown()
+    {
+        delete[] buf2;
+        delete[] buf;
+        caca_free_font(f);
+        caca_free_canvas(cv);
+    }
+
+    void test_region()
+    {
+        int x, y;
+
+        caca_render_canvas(cv, f, buf, w, h, 4 * w);
+
+        /* Check that tiles that split fullwidth characters add up to the
+         * whole canvas. */
+        memset(buf2, 0, 4 * w * h);
+        for(y = 0; y < HEIGHT; y += 3)
+            for(x = 0; x < WIDTH; x += 5)
+                CPPUNIT_ASSERT_EQUAL(0, caca_render_canvas_region(cv, f,
+                                              buf2, w, h, 4 * w, x, y, 5, 3));
+        CPPUNIT_ASSERT(!memcmp(buf, buf2, 4 * w * h));
+
+        /* Check that the other pixels are left untouched. */
+        memset(buf2, 0, 4 * w * h);
+        caca_render_canvas_region(cv, f, buf2, w, h, 4 * w, 3, 2, 4, 3);
+        CPPUNIT_ASSERT_EQUAL(0, (int)buf2[0]);
+        CPPUNIT_ASSERT_EQUAL(0, (int)buf2[4 * w * h - 1]);
+    }
+
+    void test_threads()
+    {
+        caca_render_canvas(cv, f, buf, w, h, 4 * w);
+
+        /* Check that the output does not depend on the thread count. */
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_font_threads(f, 3));
+        CPPUNIT_ASSERT_EQUAL(3, caca_get_font_threads(f));
+        memset(buf2, 0, 4 * w * h);
+        caca_render_canvas(cv, f, buf2, w, h, 4 * w);
+        CPPUNIT_ASSERT(!memcmp(buf, buf2, 4 * w * h));
+
+        /* Check that the thread count can change between calls. */
+        CPPUNIT_ASSERT_EQUAL(0, caca_set_font_threads(f, 2));
+        memset(buf2, 0, 4 * w * h);
+        caca_render_canvas(cv, f, buf2, w, h, 4 * w);
+        CPPUNIT_ASSERT(!memcmp(buf, buf2, 4 * w * h));
+
+        CPPUNIT_ASSERT_EQUAL(-1, caca_set_font_threads(f, 0));
+    }
+
+    void test_dirty()
+    {
+        caca_render_canvas(cv, f, buf, w, h, 4 * w);
+        caca_clear_dirty_rect_list(cv);
+
+        /* Change a few cells, including half of a fullwidth character. */
+        caca_set_color_ansi(cv, CACA_YELLOW, CACA_BLUE);
+        caca_put_str(cv, 2, 1, "dirty");
+        caca_put_char(cv, 15, 2, 'x');
+        caca_fill_box(cv, 15, 6, 3, 2, 0x2592 /* ▒ */);
+
+        /* Check that only rendering the dirty rectangles gives the same
+         * image as rendering the whole canvas again. */
+        CPPUNIT_ASSERT_EQUAL(0, caca_render_canvas_dirty(cv, f, buf,
+                                                         w, h, 4 * w));
+        caca_render_canvas(cv, f, buf2, w, h, 4 * w);
+        CPPUNIT_ASSERT(!memcmp(buf, buf2, 4 * w * h));
+
+        /* Check that overlapping rectangles are rendered with threads. */
+        caca_set_font_threads(f, 3);
+        caca_clear_dirty_rect_list(cv);
+        caca_disable_dirty_rect(cv);
+        caca_set_color_ansi(cv, CACA_LIGHTRED, CACA_BLACK);
+        caca_fill_box(cv, 1, 1, 10, 5, '@');
+        caca_fill_box(cv, 6, 3, 10, 6, '%');
+        caca_enable_dirty_rect(cv);
+        caca_add_dirty_rect(cv, 1, 1, 10, 5);
+        caca_add_dirty_rect(cv, 6, 3, 10, 6);
+        CPPUNIT_ASSERT_EQUAL(2, caca_get_dirty_rect_count(cv));
+        caca_render_canvas_dirty(cv, f, buf, w, h, 4 * w);
+        caca_render_canvas(cv, f, buf2, w, h, 4 * w);
+        CPPUNIT_ASSERT(!memcmp(buf, buf2, 4 * w * h));
+
+        /* Check that nothing is drawn when nothing changed. */
+        caca_clear_dirty_rect_list(cv);
+        memset(buf2, 0, 4 * w * h);
+        caca_render_canvas_dirty(cv, f, buf2, w, h, 4 * w);
+        CPPUNIT_ASSERT_EQUAL(0, (int)buf2[0]);
+        CPPUNIT_ASSERT_EQUAL(0, (int)buf2[4 * w * h - 1]);
+    }
+
+    void test_tall_glyphs()
+    {
+        /* A 2x2 font whose only glyph, 'A', is 2x4 and fully lit */
+        static uint8_t const tall[] =
+        {
+            'C', 'A', 'C', 'A',
+            0, 0, 0, 48, 0, 0, 0, 8, 0, 1, 0, 1, 0, 0, 0, 1,
+            0, 8, 0, 2, 0, 2, 0, 2, 0, 4, 0, 1,
+            0, 0, 0, 'A', 0, 0, 0, 'B', 0, 0, 0, 0,
+            0, 2, 0, 4, 0, 0, 0, 0,
+            255, 255, 255, 255, 255, 255, 255, 255,
+        };
+        caca_canvas_t *cv2;
+        caca_font_t *f2;
+        uint8_t tbuf[4 * 4 * 12], tbuf2[4 * 4 * 12];
+        int y;
+
+        f2 = caca_load_font(tall, sizeof(tall));
+        CPPUNIT_ASSERT(f2 != NULL);
+
+        /* Every other line has no glyph, so that the glyphs above reach
+         * down into it */
+        cv2 = caca_create_canvas(2, 6);
+        for(y = 0; y < 6; y += 2)
+        {
+            caca_set_color_ansi(cv2, CACA_BLUE + y, CACA_BLACK);
+            caca_put_str(cv2, 0, y, "AA");
+        }
+
+        /* Check that the output does not depend on the thread count. */
+        memset(tbuf, 0, sizeof(tbuf));
+        caca_render_canvas(cv2, f2, tbuf, 4, 12, 16);
+        caca_set_font_threads(f2, 3);
+        memset(tbuf2, 0, sizeof(tbuf2));
+        caca_render_canvas(cv2, f2, tbuf2, 4, 12, 16);
+        CPPUNIT_ASSERT(!memcmp(tbuf, tbuf2, sizeof(tbuf)));
+
+        /* Check that the glyphs are cut at the bottom of the region. */
+        memset(tbuf2, 0, sizeof(tbuf2));
+        caca_render_canvas_region(cv2, f2, tbuf2, 4, 12, 16, 0, 0, 2, 1);
+        CPPUNIT_ASSERT(!memcmp(tbuf, tbuf2, 2 * 16));
+        for(y = 2 * 16; y < (int)sizeof(tbuf2); y++)
+            CPPUNIT_ASSERT_EQUAL(0, (int)tbuf2[y]);
+
+        caca_free_canvas(cv2);
+        caca_free_font(f2);
+    }
+
+    void test_reference()
+    {
+        static uint8_t const *fonts[] = { mono9_data, monobold12_data };
+        static uint32_t const chars[] =
+        {
+            ' ', 'a', '#', 0x2588 /* █ */, 0x2591 /* ░ */, 0x00e9 /* é */,
+            0x0416 /* Ж */, 0x10400 /* 𐐀, above U+FFFF */,
+            0x0e01 /* ก, missing from the fonts */,
+        };
+        static uint16_t const colors[] =
+        {
+            0xf000, 0xffff, 0xf0f0, 0xf84c, 0x8f00, 0x40f0, 0x0fff,
+        };
+        caca_canvas_t *cv2;
+        caca_font_t *f2;
+        uint8_t *out, *ref;
+        int n, x, y, w2, h2;
+
+        cv2 = caca_create_canvas(WIDTH, HEIGHT);
+        for(y = 0; y < HEIGHT; y++)
+            for(x = 0; x < WIDTH; x++)
+            {
+                caca_set_color_argb(cv2, colors[(x + 2 * y) % 7],
+                                    colors[(3 * x + y) % 7]);
+                caca_put_char(cv2, x, y, chars[(x + y * 5) % 9]);
+            }
+
+        for(n = 0; n < 2; n++)
+        {
+            f2 = caca_load_font(caca_get_font_list()[n], 0);
+            w2 = WIDTH * caca_get_font_width(f2);
+            h2 = HEIGHT * caca_get_font_height(f2);
+            out = new uint8_t[4 * w2 * h2];
+            ref = new uint8_t[4 * w2 * h2];
+
+            /* Check that the renderer blends every glyph as the reference
+             * does, solid ones included, and leaves the cells of missing
+             * glyphs untouched. */
+            memset(out, 0x5a, 4 * w2 * h2);
+            memset(ref, 0x5a, 4 * w2 * h2);
+            caca_render_canvas(cv2, f2, out, w2, h2, 4 * w2);
+            render_reference(cv2, fonts[n], ref, 4 * w2);
+            CPPUNIT_ASSERT(!memcmp(out, ref, 4 * w2 * h2));
+
+            delete[] ref;
+            delete[] out;
+            caca_free_font(f2);
+        }
+
+        caca_free_canvas(cv2);
+    }
+
+private:
+    static uint32_t be16(uint8_t const *p)
+    {
+        return (p[0] << 8) | p[1];
+    }
+
+    static uint32_t be32(uint8_t const *p)
+    {
+        return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    /* Render a canvas one pixel at a time, straight from the font file:
+     * the glyph of each cell is searched in the block list, each of its
+     * pixels is unpacked and blends the cell's colours. */
+    static void render_reference(caca_canvas_t *cv, uint8_t const *font,
+                                 uint8_t *out, int pitch)
+    {
+        uint8_t const *blocks = font + 4 + 28;
+        uint8_t const *glyphs = blocks + 12 * be16(font + 14);
+        uint8_t const *data = font + 4 + be32(font + 4);
+        int nblocks = be16(font + 14), bpp = be16(font + 20);
+        int fw = be16(font + 22), fh = be16(font + 24);
+        int x, y, i, j, t, b;
+
+        for(y = 0; y < caca_get_canvas_height(cv); y++)
+            for(x = 0; x < caca_get_canvas_width(cv); x++)
+            {
+                uint32_t ch = caca_get_char(cv, x, y);
+                uint8_t const *g;
+                uint8_t argb[8];
+                int gw, gh;
+
+                for(b = 0; b < nblocks; b++)
+                    if(ch >= be32(blocks + 12 * b)
+                        && ch < be32(blocks + 12 * b + 4))
+                        break;
+                if(b == nblocks)
+                    continue;
+
+                g = glyphs + 8 * (be32(blocks + 12 * b + 8) + ch
+                                   - be32(blocks + 12 * b));
+                gw = be16(g);
+                gh = be16(g + 2);
+                caca_attr_to_argb64(caca_get_attr(cv, x, y), argb);
+
+                for(j = 0; j < gh; j++)
+                    for(i = 0; i < gw; i++)
+                    {
+                        int bit = (j * gw + i) * bpp;
+                        uint32_t p = data[be32(g + 4) + bit / 8];
+                        uint8_t *pixel = out + (y * fh + j) * pitch
+                                          + 4 * (x * fw + i);
+
+                        p = (p >> (8 - bpp - bit % 8)) & ((1 << bpp) - 1);
+                        p *= 0xff / ((1 << bpp) - 1);
+
+                        for(t = 0; t < 4; t++)
+                            pixel[t] = ((0xff - p) * argb[t]
+                                         + p * argb[4 + t]) / 0xf;
+                    }
+            }
+    }
+
+    static int const WIDTH, HEIGHT;
+
+    caca_canvas_t *cv;
+    caca_font_t *f;
+    uint8_t *buf, *buf2;
+    int w, h;
+};
+
+int const FontTest::WIDTH = 23;
+int const FontTest::HEIGHT = 10;
+
+CPPUNIT_TEST_SUITE_REGISTRATION(FontTest);
+
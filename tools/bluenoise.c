@@ -0,0 +1,185 @@
+/*
+ *  bluenoise     blue noise threshold map generator for libcaca
+ *  Copyright (c) 2002-2010 Sam Hocevar <sam@hocevar.net>
+ *                All Rights Reserved
+ *
+ *  This program is free software. It comes without any warranty, to
+ *  the extent permitted by applicable law. You can redistribute it
+ *  and/or modify it under the terms of the Do What The Fuck You Want
+ *  To Public License, Version 2, as published by Sam Hocevar. See
+ *  http://sam.zoy.org/wtfpl/COPYING for more details.
+ */
+
+#include "config.h"
+
+#if !defined(__KERNEL__)
+#   include <stdio.h>
+#   include <stdlib.h>
+#   include <string.h>
+#endif
+
+#include "caca_types.h"
+
+#define BLUENOISE_SIZE 64
+
+static int bluenoise[BLUENOISE_SIZE * BLUENOISE_SIZE];
+
+static int init_bluenoise(void);
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    if(init_bluenoise())
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    /* Output the threshold map */
+    printf("static int const bluenoise%ix%i[] =\n{\n",
+           BLUENOISE_SIZE, BLUENOISE_SIZE);
+    for(i = 0; i < BLUENOISE_SIZE * BLUENOISE_SIZE; i++)
+    {
+        if((i % 8) == 0) printf("    ");
+        printf("0x%02x,", bluenoise[i]);
+        printf((i % 8) == 7 ? "\n" : " ");
+    }
+    printf("};\n");
+
+    return 0;
+}
+
+/* Toroidal Gaussian filter used to measure clusters and voids */
+#define BLUENOISE_FILTER(f, p, q) \
+    (f)[((((q) / BLUENOISE_SIZE) - ((p) / BLUENOISE_SIZE)) \
+          & (BLUENOISE_SIZE - 1)) * BLUENOISE_SIZE \
+        + ((((q) % BLUENOISE_SIZE) - ((p) % BLUENOISE_SIZE)) \
+            & (BLUENOISE_SIZE - 1))]
+
+static void bluenoise_toggle(uint8_t *ones, int32_t *energy,
+                             int32_t const *filter, int p)
+{
+    int q;
+
+    ones[p] = !ones[p];
+    for(q = 0; q < BLUENOISE_SIZE * BLUENOISE_SIZE; q++)
+    {
+        if(ones[p])
+            energy[q] += BLUENOISE_FILTER(filter, p, q);
+        else
+            energy[q] -= BLUENOISE_FILTER(filter, p, q);
+    }
+}
+
+/* Find the tightest cluster (value 1) or the largest void (value 0) */
+static int bluenoise_find(uint8_t const *ones, int32_t const *energy,
+                          int value)
+{
+    int p, best = -1;
+
+    for(p = 0; p < BLUENOISE_SIZE * BLUENOISE_SIZE; p++)
+    {
+        if(ones[p] != value)
+            continue;
+        if(best < 0 || (value ? energy[p] > energy[best]
+                              : energy[p] < energy[best]))
+            best = p;
+    }
+
+    return best;
+}
+
+/* Generate the blue noise threshold map with Ulichney's void-and-cluster
+ * method: points are ranked by removing the tightest clusters from a
+ * well-spread initial pattern, then by filling the largest voids. */
+static int init_bluenoise(void)
+{
+    int const count = BLUENOISE_SIZE * BLUENOISE_SIZE;
+    uint8_t *ones, *initial;
+    int32_t *filter, *energy, *initial_energy, weight[2 * 32 * 32 + 1];
+    uint32_t seed = 1;
+    int p, c, v, x, y, rank, points;
+
+    ones = malloc(2 * count);
+    filter = malloc(3 * count * sizeof(int32_t));
+    if(!ones || !filter)
+    {
+        free(ones);
+        free(filter);
+        return -1;
+    }
+
+    initial = ones + count;
+    energy = filter + count;
+    initial_energy = energy + count;
+
+    /* exp(-r^2 / (2 * 1.5^2)) for every squared distance on the torus,
+     * in 16.16 fixed point so that no FPU is needed */
+    weight[0] = 0x10000;
+    for(p = 1; p <= 2 * 32 * 32; p++)
+        weight[p] = (uint32_t)weight[p - 1] * 52476 >> 16;
+
+    for(y = 0; y < BLUENOISE_SIZE; y++)
+        for(x = 0; x < BLUENOISE_SIZE; x++)
+    {
+        int dx = x < BLUENOISE_SIZE / 2 ? x : BLUENOISE_SIZE - x;
+        int dy = y < BLUENOISE_SIZE / 2 ? y : BLUENOISE_SIZE - y;
+        filter[y * BLUENOISE_SIZE + x] = weight[dx * dx + dy * dy];
+    }
+
+    /* Random initial pattern with a tenth of the points set */
+    memset(ones, 0, count);
+    memset(energy, 0, count * sizeof(int32_t));
+    for(points = 0; points < count / 10; )
+    {
+        seed = seed * 1103515245 + 12345;
+        p = (seed >> 8) % count;
+        if(ones[p])
+            continue;
+        bluenoise_toggle(ones, energy, filter, p);
+        points++;
+    }
+
+    /* Move points from the tightest clusters to the largest voids until
+     * the pattern is homogeneous */
+    for(rank = 0; rank < count; rank++)
+    {
+        c = bluenoise_find(ones, energy, 1);
+        bluenoise_toggle(ones, energy, filter, c);
+        v = bluenoise_find(ones, energy, 0);
+        bluenoise_toggle(ones, energy, filter, v);
+        if(v == c)
+            break;
+    }
+
+    memcpy(initial, ones, count);
+    memcpy(initial_energy, energy, count * sizeof(int32_t));
+
+    /* Rank the initial points by removing the tightest clusters */
+    for(rank = points; rank > 0; )
+    {
+        c = bluenoise_find(ones, energy, 1);
+        bluenoise_toggle(ones, energy, filter, c);
+        bluenoise[c] = --rank;
+    }
+
+    /* Rank the other points by filling the largest voids */
+    memcpy(ones, initial, count);
+    memcpy(energy, initial_energy, count * sizeof(int32_t));
+    for(rank = points; rank < count; rank++)
+    {
+        v = bluenoise_find(ones, energy, 0);
+        bluenoise_toggle(ones, energy, filter, v);
+        bluenoise[v] = rank;
+    }
+
+    /* Scale the ranks to the threshold range of the Bayer matrices */
+    for(p = 0; p < count; p++)
+        bluenoise[p] = bluenoise[p] * 256 / count;
+
+    free(ones);
+    free(filter);
+
+    return 0;
+}
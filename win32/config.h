@@ -1,5 +1,6 @@
 
 #define ALLOCCONSOLE_IN_WINDOWS_H 1
+/* #undef CACA_FIXED_POINT */
 /* #undef DEBUG -- XXX: defined in the VS project */
 /* #undef HAVE_ARPA_INET_H */
 #define HAVE_ATEXIT 1
@@ -32,6 +33,7 @@
 /* #undef HAVE_NCURSES_NCURSES_H */
 /* #undef HAVE_NETINET_IN_H */
 /* #undef HAVE_OPENGL_GL_H */
+/* #undef HAVE_PTHREAD_H */
 #define HAVE_PUTENV 1
 /* #undef HAVE_RESIZETERM */
 /* #undef HAVE_RESIZE_TERM */